@@ -14,30 +14,662 @@
 
 /***************************** MACRO DEFINITIONS ******************************/
 
+#define TEST_TIMEOUT_MS             10000
+
+/* Size of the data of the large payload test; more than one message */
+#define TEST_LARGE_DATA_SIZE        1024
+
+/* Number of asynchronous operations of the burst test; at most the outstanding operation limit */
+#define TEST_BURST_SIZE             4
+
+/* Upper bound of the Session Table size; see CFG_US_TINYAES_MAX_NUM_OF_SESSION */
+#define TEST_MAX_SESSIONS           255
+
+#define LOG_TEST(_name, _passed) \
+                LOG_PRINTF(" > tinyAES %s Test %s", _name, (_passed) ? "Success" : "Failed")
+
+/* A closed session handle is rejected whether its slot is reused or not */
+#define IS_CLOSED_SESSION(_usStatus) \
+                ((_usStatus) == usTinyAESOp_NoSession || (_usStatus) == usTinyAESOp_InvalidSession)
+
+/* Features the Microservice is not built with are rejected as invalid operations */
+#define LOG_TEST_SKIPPED(_name) \
+                LOG_PRINTF(" > tinyAES %s Test Skipped", _name)
+
 /***************************** TYPE DEFINITIONS *******************************/
 
 /**************************** FUNCTION PROTOTYPES *****************************/
 
 /******************************** VARIABLES ***********************************/
 
+/*
+ * Key, IV and data of the tests; every feature must give the ciphertext of
+ * the basic session encryption of the same data
+ */
+static uint8_t key[32];
+static uint8_t iv[16];
+static uint8_t plainData[32];
+static uint8_t encData[32];
+
 /***************************** PRIVATE FUNCTIONS ******************************/
 
+/*
+ * Multiple sessions; a closed session handle is not valid anymore
+ */
+static void testSessions(void)
+{
+    uint32_t sessionIDs[2];
+    uint8_t data[2][32];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed = true;
+    uint32_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[i], &usStatus);
+        passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    for (i = 0; passed && i < 2; i++)
+    {
+        retVal = us_tinyAES_Encrypt(sessionIDs[i], plainData, sizeof(plainData), data[i], sizeof(data[i]), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(data[i], encData, sizeof(encData)) == 0;
+    }
+
+    (void)us_tinyAES_CloseSession(sessionIDs[0], TEST_TIMEOUT_MS, &usStatus);
+    passed = passed && usStatus == usTinyAESOp_Success;
+
+    LOG_TEST("Multi-session", passed);
+
+    /* The slot may be reused, but not by the closed handle */
+    retVal = us_tinyAES_Encrypt(sessionIDs[0], plainData, sizeof(plainData), data[0], sizeof(data[0]), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Closed Session", retVal == SysStatus_Success && IS_CLOSED_SESSION(usStatus));
+
+    (void)us_tinyAES_CloseSession(sessionIDs[1], TEST_TIMEOUT_MS, &usStatus);
+}
+
+/*
+ * Data longer than a single message is chained across the messages
+ */
+static void testLargePayload(void)
+{
+    static uint8_t largeData[TEST_LARGE_DATA_SIZE];
+    static uint8_t largeEncData[TEST_LARGE_DATA_SIZE];
+    static uint8_t largeDecData[TEST_LARGE_DATA_SIZE];
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(largeData); i++)
+    {
+        largeData[i] = (uint8_t)i;
+    }
+
+    /* The first blocks are the same with the basic test */
+    memcpy(largeData, plainData, sizeof(plainData));
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    if (retVal != SysStatus_Success || usStatus != usTinyAESOp_Success)
+    {
+        LOG_TEST("Large Payload", false);
+        return;
+    }
+
+    retVal = us_tinyAES_Encrypt(sessionID, largeData, sizeof(largeData), largeEncData, sizeof(largeEncData), TEST_TIMEOUT_MS, &usStatus);
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(largeEncData, encData, sizeof(encData)) == 0;
+
+    (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+
+    /* Decrypted in two calls; the session continues the chain */
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    for (i = 0; passed && i < sizeof(largeData); i += sizeof(largeData) / 2)
+    {
+        retVal = us_tinyAES_Decrypt(sessionID, &largeEncData[i], sizeof(largeData) / 2, &largeDecData[i], sizeof(largeData) / 2, TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    LOG_TEST("Large Payload", passed && memcmp(largeDecData, largeData, sizeof(largeData)) == 0);
+
+    retVal = us_tinyAES_Encrypt(sessionID, largeData, sizeof(largeData) - 8, largeEncData, sizeof(largeEncData), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Unaligned Payload", usStatus == usTinyAESOp_InvalidParam_UnalignedSize);
+
+    (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+}
+
+/*
+ * In-place encryption in a registered region
+ */
+static void testRegion(void)
+{
+    static uint8_t region[US_TINYAES_REGION_HEADROOM + 64];
+    uint8_t* data = &region[US_TINYAES_REGION_HEADROOM];
+    uint32_t processedLen;
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_RegisterRegion(region, sizeof(region));
+    passed = retVal == SysStatus_Success;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    memcpy(data, plainData, sizeof(plainData));
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptRegion(sessionID, 0, sizeof(plainData), TEST_TIMEOUT_MS, &processedLen, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success &&
+                 processedLen == sizeof(plainData) && memcmp(data, encData, sizeof(encData)) == 0;
+    }
+
+    LOG_TEST("Region", passed);
+
+    /* Out of the region; nothing is processed */
+    retVal = us_tinyAES_EncryptRegion(sessionID, 48, 32, TEST_TIMEOUT_MS, &processedLen, &usStatus);
+    LOG_TEST("Region Bounds", retVal == SysStatus_InvalidParameter && processedLen == 0 && memcmp(data, encData, sizeof(encData)) == 0);
+
+    (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+    (void)us_tinyAES_RegisterRegion(NULL, 0);
+}
+
+/*
+ * Open, Encrypt and Close in a single request
+ */
+static void testBatch(void)
+{
+    usTinyAESBatchItem items[3];
+    uint8_t data[32];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    uint32_t closedSessionID;
+
+    memset(items, 0, sizeof(items));
+
+    items[0].operation = usTinyAESOp_OpenSession;
+    items[0].algorithm = usTinyAESAlg_AES_CBC_256;
+    items[0].key = key;
+    items[0].keyLen = sizeof(key);
+    items[0].iv = iv;
+    items[0].ivLen = sizeof(iv);
+
+    items[1].operation = usTinyAESOp_Encrypt;
+    items[1].sessionID = US_TINYAES_BATCH_LAST_SESSION;
+    items[1].input = plainData;
+    items[1].inputLen = sizeof(plainData);
+    items[1].output = data;
+    items[1].outputLen = sizeof(data);
+
+    items[2].operation = usTinyAESOp_CloseSession;
+    items[2].sessionID = US_TINYAES_BATCH_LAST_SESSION;
+
+    retVal = us_tinyAES_Batch(items, 3, TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Batch", retVal == SysStatus_Success && usStatus == usTinyAESOp_Success &&
+                      items[0].status == usTinyAESOp_Success && items[1].status == usTinyAESOp_Success &&
+                      items[2].status == usTinyAESOp_Success && memcmp(data, encData, sizeof(encData)) == 0);
+
+    /* Each item has its own status; the closed session is rejected */
+    closedSessionID = items[0].sessionID;
+    items[0] = items[1];
+    items[0].sessionID = closedSessionID;
+
+    retVal = us_tinyAES_Batch(items, 1, TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Batch Item Error", retVal == SysStatus_Success && usStatus == usTinyAESOp_Success &&
+                                 IS_CLOSED_SESSION(items[0].status));
+}
+
+/*
+ * Sessions and one-shot operations with an imported key
+ */
+static void testKeyHandle(void)
+{
+    uint8_t data[2][32];
+    uint32_t keyHandle;
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_ImportKey(usTinyAESAlg_AES_CBC_256, key, sizeof(key), TEST_TIMEOUT_MS, &keyHandle, &usStatus);
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    if (passed)
+    {
+        retVal = us_tinyAES_OpenSessionWithKey(keyHandle, iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    if (passed)
+    {
+        retVal = us_tinyAES_Encrypt(sessionID, plainData, sizeof(plainData), data[0], sizeof(data[0]), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+        (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+    }
+
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptOneShotWithKey(keyHandle, iv, sizeof(iv), plainData, sizeof(plainData), data[1], sizeof(data[1]), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    (void)us_tinyAES_ReleaseKey(keyHandle, TEST_TIMEOUT_MS, &usStatus);
+
+    LOG_TEST("Key Handle", passed && usStatus == usTinyAESOp_Success &&
+                           memcmp(data[0], encData, sizeof(encData)) == 0 && memcmp(data[1], encData, sizeof(encData)) == 0);
+
+    retVal = us_tinyAES_OpenSessionWithKey(keyHandle, iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    LOG_TEST("Released Key", retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidKey);
+}
+
+/*
+ * A new IV starts a new CBC message in the same session
+ */
+static void testSetIV(void)
+{
+    uint8_t data[3][32];
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    if (retVal != SysStatus_Success || usStatus != usTinyAESOp_Success)
+    {
+        LOG_TEST("Set IV", false);
+        return;
+    }
+
+    retVal = us_tinyAES_Encrypt(sessionID, plainData, sizeof(plainData), data[0], sizeof(data[0]), TEST_TIMEOUT_MS, &usStatus);
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    retVal = us_tinyAES_SetIV(sessionID, iv, sizeof(iv), TEST_TIMEOUT_MS, &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    retVal = us_tinyAES_Encrypt(sessionID, plainData, sizeof(plainData), data[1], sizeof(data[1]), TEST_TIMEOUT_MS, &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    retVal = us_tinyAES_EncryptWithIV(sessionID, iv, sizeof(iv), plainData, sizeof(plainData), data[2], sizeof(data[2]), TEST_TIMEOUT_MS, &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    LOG_TEST("Set IV", passed && memcmp(data[0], encData, sizeof(encData)) == 0 &&
+                       memcmp(data[1], encData, sizeof(encData)) == 0 && memcmp(data[2], encData, sizeof(encData)) == 0);
+
+    retVal = us_tinyAES_EncryptWithIV(sessionID, iv, sizeof(iv) / 2, plainData, sizeof(plainData), data[2], sizeof(data[2]), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Invalid IV", retVal == SysStatus_InvalidParameter);
+
+    (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+}
+
+/*
+ * An asynchronous operation completes while a blocking call of another
+ * session is served; the responses are matched by their tags
+ */
+static void testAsync(void)
+{
+    uint8_t data[2][32];
+    uint32_t sessionIDs[2];
+    usTinyAESTicket ticket = US_TINYAES_TICKET_NONE;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed = true;
+    uint32_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[i], &usStatus);
+        passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptAsync(sessionIDs[0], plainData, sizeof(plainData), data[0], sizeof(data[0]), NULL, NULL, &ticket);
+        passed = retVal == SysStatus_Success;
+    }
+
+    if (passed)
+    {
+        retVal = us_tinyAES_Encrypt(sessionIDs[1], plainData, sizeof(plainData), data[1], sizeof(data[1]), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+        retVal = us_tinyAES_Wait(ticket, TEST_TIMEOUT_MS, &usStatus);
+        passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    LOG_TEST("Async", passed && memcmp(data[0], encData, sizeof(encData)) == 0 && memcmp(data[1], encData, sizeof(encData)) == 0);
+
+    /* A completed ticket is released */
+    retVal = us_tinyAES_Wait(ticket, TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Released Ticket", retVal == SysStatus_InvalidParameter);
+
+    for (i = 0; i < 2; i++)
+    {
+        (void)us_tinyAES_CloseSession(sessionIDs[i], TEST_TIMEOUT_MS, &usStatus);
+    }
+}
+
+/*
+ * A timed out request does not disturb the next ones; its late response is
+ * dropped by its tag
+ */
+static void testTimeout(void)
+{
+    uint8_t data[32];
+    uint32_t sessionIDs[2];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[0], &usStatus);
+    if (retVal != SysStatus_Success || usStatus != usTinyAESOp_Success)
+    {
+        LOG_TEST("Timeout", false);
+        return;
+    }
+
+    /* Either served at once or timed out */
+    retVal = us_tinyAES_Encrypt(sessionIDs[0], plainData, sizeof(plainData), data, sizeof(data), 0, &usStatus);
+    passed = retVal == SysStatus_Success || retVal == SysStatus_Timeout;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[1], &usStatus);
+    passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    if (passed)
+    {
+        retVal = us_tinyAES_Encrypt(sessionIDs[1], plainData, sizeof(plainData), data, sizeof(data), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(data, encData, sizeof(encData)) == 0;
+
+        (void)us_tinyAES_CloseSession(sessionIDs[1], TEST_TIMEOUT_MS, &usStatus);
+    }
+
+    (void)us_tinyAES_CloseSession(sessionIDs[0], TEST_TIMEOUT_MS, &usStatus);
+
+    LOG_TEST("Timeout", passed);
+}
+
+/*
+ * A timeout beyond the deadline range is sent without a deadline
+ */
+static void testDeadline(void)
+{
+    uint8_t data[32];
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), UINT32_MAX, &sessionID, &usStatus);
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    if (passed)
+    {
+        retVal = us_tinyAES_Encrypt(sessionID, plainData, sizeof(plainData), data, sizeof(data), UINT32_MAX, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(data, encData, sizeof(encData)) == 0;
+
+        (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+    }
+
+    LOG_TEST("Long Timeout", passed);
+}
+
+/*
+ * Asynchronous burst of large payloads on separate sessions; with workers,
+ * the payloads exceed the Admission Control threshold, so the requests
+ * rejected as Busy are retried until all of them are done
+ */
+static void testBurst(void)
+{
+    static uint8_t burstData[TEST_LARGE_DATA_SIZE];
+    static uint8_t burstEncData[TEST_BURST_SIZE][TEST_LARGE_DATA_SIZE];
+    uint32_t sessionIDs[TEST_BURST_SIZE];
+    usTinyAESTicket tickets[TEST_BURST_SIZE];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed = true;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(burstData); i++)
+    {
+        burstData[i] = (uint8_t)i;
+    }
+
+    /* The first blocks are the same with the basic test */
+    memcpy(burstData, plainData, sizeof(plainData));
+
+    for (i = 0; i < TEST_BURST_SIZE; i++)
+    {
+        tickets[i] = US_TINYAES_TICKET_NONE;
+
+        retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[i], &usStatus);
+        passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    for (i = 0; passed && i < TEST_BURST_SIZE; i++)
+    {
+        retVal = us_tinyAES_EncryptAsync(sessionIDs[i], burstData, sizeof(burstData), burstEncData[i], sizeof(burstEncData[i]), NULL, NULL, &tickets[i]);
+        passed = retVal == SysStatus_Success;
+    }
+
+    for (i = 0; i < TEST_BURST_SIZE; i++)
+    {
+        if (tickets[i] != US_TINYAES_TICKET_NONE)
+        {
+            retVal = us_tinyAES_Wait(tickets[i], TEST_TIMEOUT_MS, &usStatus);
+            passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success &&
+                     memcmp(burstEncData[i], burstEncData[0], sizeof(burstEncData[0])) == 0;
+        }
+    }
+
+    LOG_TEST("Async Burst", passed && memcmp(burstEncData[0], encData, sizeof(encData)) == 0);
+
+    for (i = 0; i < TEST_BURST_SIZE; i++)
+    {
+        (void)us_tinyAES_CloseSession(sessionIDs[i], TEST_TIMEOUT_MS, &usStatus);
+    }
+}
+
+/*
+ * The priority of a session changes only the order it is served in
+ */
+static void testPriority(void)
+{
+    uint8_t data[32];
+    uint32_t sessionID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionID, &usStatus);
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    if (passed)
+    {
+        retVal = us_tinyAES_SetSessionPriority(sessionID, usTinyAESPriority_Bulk, TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    if (passed)
+    {
+        retVal = us_tinyAES_Encrypt(sessionID, plainData, sizeof(plainData), data, sizeof(data), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(data, encData, sizeof(encData)) == 0;
+    }
+
+    LOG_TEST("Session Priority", passed);
+
+    retVal = us_tinyAES_SetSessionPriority(sessionID, (usTinyAESPriority)(usTinyAESPriority_Bulk + 1), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Invalid Priority", retVal == SysStatus_InvalidParameter);
+
+    (void)us_tinyAES_CloseSession(sessionID, TEST_TIMEOUT_MS, &usStatus);
+}
+
+/*
+ * A full Session Table rejects new sessions unless an idle session can be
+ * evicted; the sessions opened here are never idle long enough
+ */
+static void testSessionTable(void)
+{
+    uint32_t sessionIDs[TEST_MAX_SESSIONS];
+    usTinyAESStatus usStatus = usTinyAESOp_Success;
+    SysStatus retVal = SysStatus_Success;
+    uint32_t numOfSessions;
+    uint32_t i;
+
+    for (numOfSessions = 0; numOfSessions < TEST_MAX_SESSIONS; numOfSessions++)
+    {
+        retVal = us_tinyAES_OpenSession(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &sessionIDs[numOfSessions], &usStatus);
+
+        if (retVal != SysStatus_Success || usStatus != usTinyAESOp_Success)
+        {
+            break;
+        }
+    }
+
+    LOG_TEST("Full Session Table", numOfSessions > 0 && retVal == SysStatus_Success && usStatus == usTinyAESOp_NoSessionSlotAvailable);
+
+    for (i = 0; i < numOfSessions; i++)
+    {
+        (void)us_tinyAES_CloseSession(sessionIDs[i], TEST_TIMEOUT_MS, &usStatus);
+    }
+}
+
+/*
+ * Session Tickets; the sealed state must give the same ciphertext, and a
+ * modified ticket is rejected
+ */
+static void testSessionTicket(void)
+{
+    usTinyAESSessionTicket ticket;
+    uint8_t data[32];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_OpenSessionTicket(usTinyAESAlg_AES_CBC_256, key, sizeof(key), iv, sizeof(iv), TEST_TIMEOUT_MS, &ticket, &usStatus);
+    if (retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidOperation)
+    {
+        /* Built without CFG_US_TINYAES_SESSION_TICKETS */
+        LOG_TEST_SKIPPED("Session Ticket");
+        return;
+    }
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    /* In two calls; the updated ticket continues the chain */
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptWithSessionTicket(&ticket, plainData, 16, data, 16, TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptWithSessionTicket(&ticket, &plainData[16], 16, &data[16], 16, TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    LOG_TEST("Session Ticket", passed && memcmp(data, encData, sizeof(encData)) == 0);
+
+    ticket.data[sizeof(ticket.data) / 2] ^= 0x01;
+    retVal = us_tinyAES_EncryptWithSessionTicket(&ticket, plainData, 16, data, 16, TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Modified Session Ticket", retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidSession);
+}
+
+/*
+ * Key Store; a stored key works like an imported one until it is deleted
+ */
+static void testKeyStore(void)
+{
+    uint8_t data[32];
+    uint32_t keyID;
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed;
+
+    retVal = us_tinyAES_StoreKey(usTinyAESAlg_AES_CBC_256, key, sizeof(key), TEST_TIMEOUT_MS, &keyID, &usStatus);
+    if (retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidOperation)
+    {
+        /* Built without CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY */
+        LOG_TEST_SKIPPED("Key Store");
+        return;
+    }
+    passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+
+    if (passed)
+    {
+        retVal = us_tinyAES_EncryptOneShotWithKey(keyID, iv, sizeof(iv), plainData, sizeof(plainData), data, sizeof(data), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success && memcmp(data, encData, sizeof(encData)) == 0;
+    }
+
+    (void)us_tinyAES_DeleteKey(keyID, TEST_TIMEOUT_MS, &usStatus);
+
+    LOG_TEST("Key Store", passed && usStatus == usTinyAESOp_Success);
+
+    retVal = us_tinyAES_EncryptOneShotWithKey(keyID, iv, sizeof(iv), plainData, sizeof(plainData), data, sizeof(data), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Deleted Key", retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidKey);
+}
+
+/*
+ * Device Key; keys derived from it are the same for the same caller, label
+ * and context. The Device Key itself is not allowed by default.
+ */
+static void testDeviceKey(void)
+{
+    uint8_t label[] = { 'S', 'I', 'M' };
+    uint8_t data[2][32];
+    uint32_t keyHandles[2];
+    usTinyAESStatus usStatus;
+    SysStatus retVal;
+    bool passed = true;
+    uint32_t i;
+
+    for (i = 0; i < 2; i++)
+    {
+        retVal = us_tinyAES_DeriveKey(US_TINYAES_DEVICE_KEY_HANDLE, label, sizeof(label), iv, sizeof(iv), TEST_TIMEOUT_MS, &keyHandles[i], &usStatus);
+        if (i == 0 && retVal == SysStatus_Success &&
+            (usStatus == usTinyAESOp_InvalidOperation || usStatus == usTinyAESOp_InvalidKey))
+        {
+            /* Built without CFG_US_TINYAES_KEY_DERIVATION or CFG_US_TINYAES_DEVICE_KEY */
+            LOG_TEST_SKIPPED("Device Key");
+            return;
+        }
+        passed = passed && retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    for (i = 0; passed && i < 2; i++)
+    {
+        retVal = us_tinyAES_EncryptOneShotWithKey(keyHandles[i], iv, sizeof(iv), plainData, sizeof(plainData), data[i], sizeof(data[i]), TEST_TIMEOUT_MS, &usStatus);
+        passed = retVal == SysStatus_Success && usStatus == usTinyAESOp_Success;
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        (void)us_tinyAES_ReleaseKey(keyHandles[i], TEST_TIMEOUT_MS, &usStatus);
+    }
+
+    LOG_TEST("Device Key Derivation", passed && memcmp(data[0], data[1], sizeof(data[0])) == 0 &&
+                                      memcmp(data[0], encData, sizeof(encData)) != 0);
+
+    retVal = us_tinyAES_EncryptOneShotWithKey(US_TINYAES_DEVICE_KEY_HANDLE, iv, sizeof(iv), plainData, sizeof(plainData), data[0], sizeof(data[0]), TEST_TIMEOUT_MS, &usStatus);
+    LOG_TEST("Device Key Access", retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidKey);
+}
+
 void tinyAESTest(void)
 {
 #define CHECK_AES_ERR(sysStatus, usStatus) \
                 if (sysStatus != SysStatus_Success || usStatus != usTinyAESOp_Success) \
                 { LOG_PRINTF(" > AES Test Failed. Line %d. Sys Status %d | usAES Status %d", __LINE__, sysStatus, usStatus); return; }
-    uint8_t key[32];
-    uint8_t iv[16];
-    uint8_t plainData[32];
-    uint8_t encData[32];
     uint8_t decData[32];
 
     uint32_t sessionID;
     usTinyAESStatus usStatus;
-    uint32_t timeoutInMs = 10000;
+    uint32_t timeoutInMs = TEST_TIMEOUT_MS;
     SysStatus retVal;
 
+    memset(key, 0x5A, sizeof key);
+    memset(iv, 0xA5, sizeof iv);
+
     memset(plainData, 0, sizeof plainData);
     memcpy(plainData, "ZAYA", sizeof("ZAYA"));
 
@@ -77,6 +709,100 @@ void tinyAESTest(void)
     }
 
     LOG_PRINTF(" > tinyAES Encryption Test %s", memcmp(plainData, decData, sizeof(plainData)) == 0 ? "Success" : "Failed");
+
+    /* One-shot Encrypt; must match the session encryption */
+    {
+        uint8_t oneShotData[32];
+
+        retVal = us_tinyAES_EncryptOneShot(usTinyAESAlg_AES_CBC_256,
+            key, sizeof(key),
+            iv, sizeof(iv),
+            plainData, sizeof(plainData), oneShotData, sizeof(oneShotData), timeoutInMs, &usStatus);
+        CHECK_AES_ERR(retVal, usStatus);
+
+        LOG_PRINTF(" > tinyAES One-shot Encryption Test %s", memcmp(oneShotData, encData, sizeof(encData)) == 0 ? "Success" : "Failed");
+
+        retVal = us_tinyAES_EncryptOneShot(usTinyAESAlg_AES_CBC_256,
+            key, sizeof(key),
+            iv, sizeof(iv),
+            plainData, sizeof(plainData) - 8, oneShotData, sizeof(oneShotData), timeoutInMs, &usStatus);
+        LOG_TEST("One-shot Unaligned", usStatus == usTinyAESOp_InvalidParam_UnalignedSize);
+    }
+
+    testSessions();
+    testLargePayload();
+    testRegion();
+    testBatch();
+    testKeyHandle();
+    testSetIV();
+    testAsync();
+    testTimeout();
+    testDeadline();
+    testBurst();
+    testPriority();
+    testSessionTable();
+    testSessionTicket();
+    testKeyStore();
+    testDeviceKey();
+
+    /*
+     * Key Derivation Known Answer; SP 800-108 KDF with AES-CMAC of the parent
+     * key 00..1F, label "KAT" and context 00..07 gives the key
+     * 75040D7AFBCA839C180FDFCFBAD8AD19C6650D211C25142F9B3800428EF144DA
+     */
+    {
+        uint8_t parentKey[32];
+        uint8_t kdfLabel[] = { 'K', 'A', 'T' };
+        uint8_t kdfContext[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
+        uint8_t zeroBlock[16];
+        uint8_t kdfData[16];
+        /* Zero block encrypted with the derived key and a zero IV */
+        const uint8_t kdfExpected[16] = { 0xB2, 0x0A, 0x17, 0x24, 0xEC, 0x2F, 0x77, 0x6F,
+                                          0x5E, 0x80, 0xF7, 0x45, 0x58, 0xBF, 0x69, 0x7B };
+        uint32_t parentKeyHandle;
+        uint32_t childKeyHandle;
+        uint32_t i;
+
+        for (i = 0; i < sizeof(parentKey); i++)
+        {
+            parentKey[i] = (uint8_t)i;
+        }
+
+        memset(zeroBlock, 0, sizeof(zeroBlock));
+
+        retVal = us_tinyAES_ImportKey(usTinyAESAlg_AES_CBC_256, parentKey, sizeof(parentKey), timeoutInMs, &parentKeyHandle, &usStatus);
+        CHECK_AES_ERR(retVal, usStatus);
+
+        retVal = us_tinyAES_DeriveKey(parentKeyHandle, kdfLabel, sizeof(kdfLabel), kdfContext, sizeof(kdfContext),
+            timeoutInMs, &childKeyHandle, &usStatus);
+        if (retVal == SysStatus_Success && usStatus == usTinyAESOp_InvalidOperation)
+        {
+            /* Built without CFG_US_TINYAES_KEY_DERIVATION */
+            LOG_PRINTF(" > tinyAES Key Derivation Test Skipped");
+        }
+        else
+        {
+            CHECK_AES_ERR(retVal, usStatus);
+
+            retVal = us_tinyAES_EncryptOneShotWithKey(childKeyHandle, zeroBlock, sizeof(zeroBlock),
+                zeroBlock, sizeof(zeroBlock), kdfData, sizeof(kdfData), timeoutInMs, &usStatus);
+            CHECK_AES_ERR(retVal, usStatus);
+
+            LOG_PRINTF(" > tinyAES Key Derivation Test %s", memcmp(kdfData, kdfExpected, sizeof(kdfExpected)) == 0 ? "Success" : "Failed");
+
+            retVal = us_tinyAES_ReleaseKey(childKeyHandle, timeoutInMs, &usStatus);
+            CHECK_AES_ERR(retVal, usStatus);
+
+            /* The label must not contain the zero separator */
+            kdfLabel[1] = 0x00;
+            retVal = us_tinyAES_DeriveKey(parentKeyHandle, kdfLabel, sizeof(kdfLabel), kdfContext, sizeof(kdfContext),
+                timeoutInMs, &childKeyHandle, &usStatus);
+            LOG_PRINTF(" > tinyAES Key Derivation Label Test %s", usStatus == usTinyAESOp_InvalidParam_Label ? "Success" : "Failed");
+        }
+
+        retVal = us_tinyAES_ReleaseKey(parentKeyHandle, timeoutInMs, &usStatus);
+        CHECK_AES_ERR(retVal, usStatus);
+    }
 }
 
 /***************************** PUBLIC FUNCTIONS *******************************/
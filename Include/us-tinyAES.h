@@ -13,6 +13,46 @@
 
 /***************************** MACRO DEFINITIONS ******************************/
 
+/*
+ * Reserved bytes at the beginning of a registered region.
+ * See us_tinyAES_RegisterRegion()
+ */
+#define US_TINYAES_REGION_HEADROOM          (32)
+
+/*
+ * Session ID to refer the session opened by the latest OpenSession item in
+ * the same batch. See us_tinyAES_Batch()
+ */
+#define US_TINYAES_BATCH_LAST_SESSION       ((uint32_t)0xFFFFFFFF)
+
+/*
+ * Invalid ticket. See us_tinyAES_EncryptAsync()
+ */
+#define US_TINYAES_TICKET_NONE              ((usTinyAESTicket)0)
+
+/*
+ * Key Handle of the Device Key; an AES-256 key derived from the device secret
+ * in the Microservice. Accepted wherever a Key Handle is, when the
+ * Microservice is built with CFG_US_TINYAES_DEVICE_KEY. It is never released.
+ *
+ * WARNING: The Device Key is the same for every caller allowed to use it (see
+ * CFG_US_TINYAES_DEVICE_KEY_ALLOWED), so they can decrypt each other's data;
+ * others get usTinyAESOp_InvalidKey. Any caller may derive a key from it with
+ * us_tinyAES_DeriveKey(); such keys are bound to the caller.
+ */
+#define US_TINYAES_DEVICE_KEY_HANDLE        ((uint32_t)0xFFFFFFFF)
+
+/*
+ * Maximum label and context sizes of a key derivation. See us_tinyAES_DeriveKey()
+ */
+#define US_TINYAES_DERIVE_MAX_LABEL_SIZE    (32)
+#define US_TINYAES_DERIVE_MAX_CONTEXT_SIZE  (64)
+
+/*
+ * Size of a session ticket. See us_tinyAES_OpenSessionTicket()
+ */
+#define US_TINYAES_SESSION_TICKET_SIZE      (84)
+
 /***************************** TYPE DEFINITIONS *******************************/
 
 typedef enum
@@ -31,6 +71,23 @@ typedef enum
     usTinyAESOp_InvalidParam_SizeExceedAllowed,
     
     usTinyAESOp_InvalidParam_Key,
+
+    usTinyAESOp_InvalidParam_UnalignedSize,
+
+    usTinyAESOp_NoKeySlotAvailable,
+    usTinyAESOp_InvalidKey,
+
+    /* Rejected by the Admission Control or a request buffer limit; the User Library retries with backoff */
+    usTinyAESOp_Busy,
+
+    /* Rejected by the caller rate limit; the User Library retries after the refill */
+    usTinyAESOp_Throttled,
+
+    /* Microcontainer Storage cannot be read or written */
+    usTinyAESOp_StorageError,
+
+    /* Key derivation label contains a zero byte */
+    usTinyAESOp_InvalidParam_Label,
 } usTinyAESStatus;
 
 typedef enum
@@ -40,14 +97,103 @@ typedef enum
     usTinyAESOp_CloseSession,
     usTinyAESOp_Encrypt,
     usTinyAESOp_Decrypt,
+    usTinyAESOp_Batch,
+    usTinyAESOp_EncryptOneShot,
+    usTinyAESOp_DecryptOneShot,
+    usTinyAESOp_ImportKey,
+    usTinyAESOp_ReleaseKey,
+    usTinyAESOp_OpenSessionWithKey,
+    usTinyAESOp_EncryptOneShotWithKey,
+    usTinyAESOp_DecryptOneShotWithKey,
+    usTinyAESOp_SetIV,
+    usTinyAESOp_OpenSessionTicket,
+    usTinyAESOp_EncryptWithSessionTicket,
+    usTinyAESOp_DecryptWithSessionTicket,
+    usTinyAESOp_StoreKey,
+    usTinyAESOp_DeleteKey,
+    usTinyAESOp_DeriveKey,
+    usTinyAESOp_SetSessionPriority,
 } usTinyAESOp;
 
+/*
+ * Priority lane of the requests of a session. See us_tinyAES_SetSessionPriority()
+ */
+typedef enum
+{
+    /* Session/Key management in the control lane, the rest in the interactive lane */
+    usTinyAESPriority_Default = 0,
+    usTinyAESPriority_Control,
+    usTinyAESPriority_Interactive,
+    usTinyAESPriority_Bulk,
+} usTinyAESPriority;
+
 typedef enum
 {
     usTinyAESAlg_None = 0,
     usTinyAESAlg_AES_CBC_256 = 1,
 } usTinyAESAlg;
 
+/*
+ * An operation in a batch request. See us_tinyAES_Batch()
+ */
+typedef struct
+{
+    /* OpenSession, OpenSessionWithKey, CloseSession, Encrypt or Decrypt */
+    usTinyAESOp operation;
+
+    /*
+     * OpenSession(WithKey) : [out] Opened Session ID
+     * Others               : [in] Session ID or US_TINYAES_BATCH_LAST_SESSION
+     */
+    uint32_t sessionID;
+
+    /* OpenSessionWithKey Parameters; iv and ivLen below are used as well */
+    uint32_t keyHandle;
+
+    /* OpenSession Parameters */
+    usTinyAESAlg algorithm;
+    uint8_t* key;
+    uint32_t keyLen;
+    uint8_t* iv;
+    uint32_t ivLen;
+
+    /*
+     * Encrypt/Decrypt Parameters; if iv is not NULL, the session IV is reset
+     * with iv/ivLen above before the input is processed
+     */
+    uint8_t* input;
+    uint32_t inputLen;
+    uint8_t* output;
+    uint32_t outputLen;
+
+    /* [out] tinyAES Specific Status/Error of the operation */
+    usTinyAESStatus status;
+} usTinyAESBatchItem;
+
+/*
+ * Ticket of an asynchronous operation. See us_tinyAES_EncryptAsync()
+ */
+typedef uint32_t usTinyAESTicket;
+
+/*
+ * Session state sealed by the Microservice; opaque to the caller.
+ * See us_tinyAES_OpenSessionTicket()
+ */
+typedef struct
+{
+    uint8_t data[US_TINYAES_SESSION_TICKET_SIZE];
+} usTinyAESSessionTicket;
+
+/*
+ * Completion callback of an asynchronous operation. Called in the context of
+ * us_tinyAES_Poll() or us_tinyAES_Wait(); the ticket is released right after.
+ *
+ * @param ticket Ticket of the completed operation
+ * @param retVal SysStatus of the operation
+ * @param usStatus tinyAES Specific Status/Error of the operation
+ * @param arg Callback argument given with the operation
+ */
+typedef void (*usTinyAESCallback)(usTinyAESTicket ticket, SysStatus retVal, usTinyAESStatus usStatus, void* arg);
 
 /**************************** FUNCTION PROTOTYPES *****************************/
 
@@ -99,6 +245,9 @@ SysStatus us_tinyAES_CloseSession(uint32_t sessionID, uint32_t timeoutInMs, usTi
 /*
  * AES Encryption
  *
+ * Data length must be multiple of AES block size (16 bytes). There is no upper
+ * limit; data longer than a single message is sent in multiple messages.
+ *
  * @param sessionID AES Session ID
  * @param plainData Plaindata to encrypt
  * @param[out] cipherData Encrypted Output
@@ -112,6 +261,9 @@ SysStatus us_tinyAES_Encrypt(uint32_t sessionID, uint8_t* plainData, uint32_t pl
 /*
  * AES Decryption
  *
+ * Data length must be multiple of AES block size (16 bytes). There is no upper
+ * limit; data longer than a single message is sent in multiple messages.
+ *
  * @param sessionID AES Session ID
  * @param plainData Plaindata to encrypt
  * @param[out] cipherData Encrypted Output
@@ -122,4 +274,514 @@ SysStatus us_tinyAES_Encrypt(uint32_t sessionID, uint8_t* plainData, uint32_t pl
  */
 SysStatus us_tinyAES_Decrypt(uint32_t sessionID, uint8_t* cipherData, uint32_t cipherDataLen, uint8_t* plainData, uint32_t plainDataLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
 
+/*
+ * Resets the IV of an AES Session
+ *
+ * Starts a new CBC message under the session key without closing and
+ * reopening the session, so the key is not expanded again.
+ *
+ * @param sessionID AES Session ID
+ * @param iv AES Initialisation Vector
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_SetIV(uint32_t sessionID, uint8_t* iv, uint32_t ivLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * AES Encryption with a new IV
+ *
+ * Same with us_tinyAES_SetIV() followed by us_tinyAES_Encrypt() but the IV is
+ * carried in the first Encryption message, so there is no extra round trip.
+ *
+ * @param sessionID AES Session ID
+ * @param iv AES Initialisation Vector
+ * @param plainData Plaindata to encrypt
+ * @param[out] cipherData Encrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_EncryptWithIV(uint32_t sessionID,
+                                   uint8_t* iv, uint32_t ivLen,
+                                   uint8_t* plainData, uint32_t plainDataLen,
+                                   uint8_t* cipherData, uint32_t cipherDataLen,
+                                   uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * AES Decryption with a new IV
+ *
+ * See us_tinyAES_EncryptWithIV()
+ *
+ * @param sessionID AES Session ID
+ * @param iv AES Initialisation Vector
+ * @param cipherData Encrypted data
+ * @param[out] plainData Decrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DecryptWithIV(uint32_t sessionID,
+                                   uint8_t* iv, uint32_t ivLen,
+                                   uint8_t* cipherData, uint32_t cipherDataLen,
+                                   uint8_t* plainData, uint32_t plainDataLen,
+                                   uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * One-shot AES Encryption without a session
+ *
+ * The key, IV and the data are sent in a single request and no session slot is
+ * allocated. Data longer than a single message is sent in multiple messages;
+ * each message continues the CBC chain from the previous one.
+ *
+ * @param algorithm AES Algorithm See usTinyAESAlg
+ * @param key AES Key
+ * @param iv AES Initialisation Vector
+ * @param plainData Plaindata to encrypt; multiple of AES block size (16 bytes)
+ * @param[out] cipherData Encrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_EncryptOneShot(usTinyAESAlg algorithm,
+                                    uint8_t* key, uint32_t keyLen,
+                                    uint8_t* iv, uint32_t ivLen,
+                                    uint8_t* plainData, uint32_t plainDataLen,
+                                    uint8_t* cipherData, uint32_t cipherDataLen,
+                                    uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * One-shot AES Decryption without a session
+ *
+ * See us_tinyAES_EncryptOneShot()
+ *
+ * @param algorithm AES Algorithm See usTinyAESAlg
+ * @param key AES Key
+ * @param iv AES Initialisation Vector
+ * @param cipherData Encrypted data; multiple of AES block size (16 bytes)
+ * @param[out] plainData Decrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DecryptOneShot(usTinyAESAlg algorithm,
+                                    uint8_t* key, uint32_t keyLen,
+                                    uint8_t* iv, uint32_t ivLen,
+                                    uint8_t* cipherData, uint32_t cipherDataLen,
+                                    uint8_t* plainData, uint32_t plainDataLen,
+                                    uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Imports an AES Key
+ *
+ * The key is expanded once in the Microservice; sessions and one-shot
+ * operations refer the key by its handle, so neither the key is sent nor the
+ * key expansion is repeated for them. Only the importer can use the handle.
+ *
+ * @param algorithm AES Algorithm See usTinyAESAlg
+ * @param key AES Key
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] keyHandle Key Handle
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_ImportKey(usTinyAESAlg algorithm,
+                               uint8_t* key, uint32_t keyLen,
+                               uint32_t timeoutInMs,
+                               uint32_t* keyHandle,
+                               usTinyAESStatus* usStatus);
+
+/*
+ * Releases an imported AES Key
+ *
+ * Sessions opened with the key are not affected.
+ *
+ * @param keyHandle Key Handle
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_ReleaseKey(uint32_t keyHandle, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Stores an AES Key in the Key Store of the Microservice
+ *
+ * The key is encrypted and authenticated with a key derived from the device
+ * secret of the Microservice and kept in the Microcontainer Storage, so it
+ * survives restarts. The returned Stored Key ID does not change and can be
+ * used wherever a Key Handle is accepted; the most used keys are expanded
+ * before any request arrives after a restart. The key is bound to the
+ * Execution Name of the storer, so only a Microcontainer with the same name
+ * can use or delete it. After usTinyAESOp_DeleteKey, the ID is never valid
+ * again, even when a new key is stored in its place.
+ *
+ * The Key Store is available when the Microservice is built with
+ * CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY.
+ *
+ * @param algorithm AES Algorithm See usTinyAESAlg
+ * @param key AES Key
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] keyID Stored Key ID
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_StoreKey(usTinyAESAlg algorithm,
+                              uint8_t* key, uint32_t keyLen,
+                              uint32_t timeoutInMs,
+                              uint32_t* keyID,
+                              usTinyAESStatus* usStatus);
+
+/*
+ * Deletes a stored AES Key from the Key Store
+ *
+ * Sessions opened with the key are not affected.
+ *
+ * @param keyID Stored Key ID
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DeleteKey(uint32_t keyID, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Derives an AES Key from a parent key in the Microservice
+ *
+ * The child key is derived with the SP 800-108 KDF in counter mode with
+ * AES-CMAC, keyed by the parent key, and expanded once like an imported key;
+ * neither key leaves the Microservice. The same parent, label and context
+ * always give the same key, so the child key can be derived again instead of
+ * being kept. Release it with us_tinyAES_ReleaseKey().
+ *
+ * Keys derived from US_TINYAES_DEVICE_KEY_HANDLE are bound to the Execution
+ * Name of the caller, which is part of the KDF context; other Executions get
+ * a different key from the same label and context.
+ *
+ * Key Derivation is available when the Microservice is built with
+ * CFG_US_TINYAES_KEY_DERIVATION.
+ *
+ * @param parentKeyHandle Key Handle See us_tinyAES_ImportKey(), us_tinyAES_StoreKey() and US_TINYAES_DEVICE_KEY_HANDLE
+ * @param label Purpose of the key; up to US_TINYAES_DERIVE_MAX_LABEL_SIZE bytes without a zero byte
+ * @param context Context of the key, e.g. a record or peer ID; up to US_TINYAES_DERIVE_MAX_CONTEXT_SIZE bytes
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] keyHandle Key Handle of the derived key
+ * @param[out] usStatus tinyAES Specific Status/Error; usTinyAESOp_InvalidParam_Label
+ *                      if the label contains a zero byte
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DeriveKey(uint32_t parentKeyHandle,
+                               uint8_t* label, uint32_t labelLen,
+                               uint8_t* context, uint32_t contextLen,
+                               uint32_t timeoutInMs,
+                               uint32_t* keyHandle,
+                               usTinyAESStatus* usStatus);
+
+/*
+ * Opens an AES Session with an imported key
+ *
+ * @param keyHandle Key Handle See us_tinyAES_ImportKey(), us_tinyAES_StoreKey() and US_TINYAES_DEVICE_KEY_HANDLE
+ * @param iv AES Initialisation Vector
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] sessionID Session Handle to use in AES operations during this session
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_OpenSessionWithKey(uint32_t keyHandle,
+                                        uint8_t* iv, uint32_t ivLen,
+                                        uint32_t timeoutInMs,
+                                        uint32_t* sessionID,
+                                        usTinyAESStatus* usStatus);
+
+/*
+ * One-shot AES Encryption with an imported key
+ *
+ * See us_tinyAES_EncryptOneShot()
+ *
+ * @param keyHandle Key Handle See us_tinyAES_ImportKey(), us_tinyAES_StoreKey() and US_TINYAES_DEVICE_KEY_HANDLE
+ * @param iv AES Initialisation Vector
+ * @param plainData Plaindata to encrypt; multiple of AES block size (16 bytes)
+ * @param[out] cipherData Encrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_EncryptOneShotWithKey(uint32_t keyHandle,
+                                           uint8_t* iv, uint32_t ivLen,
+                                           uint8_t* plainData, uint32_t plainDataLen,
+                                           uint8_t* cipherData, uint32_t cipherDataLen,
+                                           uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * One-shot AES Decryption with an imported key
+ *
+ * See us_tinyAES_EncryptOneShot()
+ *
+ * @param keyHandle Key Handle See us_tinyAES_ImportKey(), us_tinyAES_StoreKey() and US_TINYAES_DEVICE_KEY_HANDLE
+ * @param iv AES Initialisation Vector
+ * @param cipherData Encrypted data; multiple of AES block size (16 bytes)
+ * @param[out] plainData Decrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DecryptOneShotWithKey(uint32_t keyHandle,
+                                           uint8_t* iv, uint32_t ivLen,
+                                           uint8_t* cipherData, uint32_t cipherDataLen,
+                                           uint8_t* plainData, uint32_t plainDataLen,
+                                           uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Executes multiple operations in a single request/response
+ *
+ * Items are executed in order, and each item has its own status. A typical
+ * usage is OpenSession + Encrypt + CloseSession where Encrypt and CloseSession
+ * items use US_TINYAES_BATCH_LAST_SESSION as the session ID.
+ *
+ * All items must fit in a single message.
+ *
+ * @param items Batch Items
+ * @param itemCount Number of items
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error of the batch request
+ *
+ * @retval SysStatus_Success Success
+ * @retval SysStatus_InvalidSize Items do not fit in a single message
+ */
+SysStatus us_tinyAES_Batch(usTinyAESBatchItem* items, uint32_t itemCount, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Registers a caller buffer region for in-place AES operations.
+ *
+ * Region operations send the data to the Microservice directly from the
+ * region and receive the result directly into the region, so there is no copy
+ * between the caller buffers and the IPC messages.
+ *
+ * The first US_TINYAES_REGION_HEADROOM bytes of the region are reserved for
+ * the message headers; region offsets are relative to the end of the headroom.
+ * The caller must not access the region during a region operation.
+ *
+ * The data is processed in place message by message, so a failed region
+ * operation leaves the data partly processed; see the processedLen of the
+ * region operations.
+ *
+ * @param region Region; NULL to unregister
+ * @param regionLen Region length including the headroom
+ *
+ * @retval SysStatus_Success Success
+ * @retval SysStatus_InvalidSize Region is not larger than the headroom
+ */
+SysStatus us_tinyAES_RegisterRegion(uint8_t* region, uint32_t regionLen);
+
+/*
+ * AES Encryption in the registered region
+ *
+ * @param sessionID AES Session ID
+ * @param offset Data offset in the region
+ * @param length Data length; multiple of AES block size (16 bytes)
+ * @param timeoutInMs Timeout for each message
+ * @param[out] processedLen Length of the data encrypted; less than length on
+ *             a failure, the data after it is left as it was and the session
+ *             continues from it
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_EncryptRegion(uint32_t sessionID, uint32_t offset, uint32_t length, uint32_t timeoutInMs, uint32_t* processedLen, usTinyAESStatus* usStatus);
+
+/*
+ * AES Decryption in the registered region
+ *
+ * @param sessionID AES Session ID
+ * @param offset Data offset in the region
+ * @param length Data length; multiple of AES block size (16 bytes)
+ * @param timeoutInMs Timeout for each message
+ * @param[out] processedLen Length of the data decrypted; less than length on
+ *             a failure, the data after it is left as it was and the session
+ *             continues from it
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_DecryptRegion(uint32_t sessionID, uint32_t offset, uint32_t length, uint32_t timeoutInMs, uint32_t* processedLen, usTinyAESStatus* usStatus);
+
+/*
+ * Asynchronous AES Encryption
+ *
+ * Sends the request and returns without waiting for the response, so the
+ * caller can submit more operations and continue its own work while the
+ * Microservice processes them. Data longer than a single message is sent
+ * message by message as the previous responses are processed. Operations on
+ * the same session are processed one after another in submission order.
+ *
+ * The buffers must stay valid until the operation completes. Blocking calls
+ * can be used meanwhile; responses are matched to requests by their tags.
+ *
+ * @param sessionID AES Session ID
+ * @param plainData Plaindata to encrypt; multiple of AES block size (16 bytes)
+ * @param[out] cipherData Encrypted Output
+ * @param callback Completion callback; NULL to complete with us_tinyAES_Poll()/Wait()
+ * @param callbackArg Argument to pass to the callback
+ * @param[out] ticket Ticket of the operation
+ *
+ * @retval SysStatus_Success Request sent
+ * @retval SysStatus_NoSlotAvailable Too many outstanding operations
+ */
+SysStatus us_tinyAES_EncryptAsync(uint32_t sessionID,
+                                  uint8_t* plainData, uint32_t plainDataLen,
+                                  uint8_t* cipherData, uint32_t cipherDataLen,
+                                  usTinyAESCallback callback, void* callbackArg,
+                                  usTinyAESTicket* ticket);
+
+/*
+ * Asynchronous AES Decryption
+ *
+ * See us_tinyAES_EncryptAsync()
+ *
+ * @param sessionID AES Session ID
+ * @param cipherData Encrypted data; multiple of AES block size (16 bytes)
+ * @param[out] plainData Decrypted Output
+ * @param callback Completion callback; NULL to complete with us_tinyAES_Poll()/Wait()
+ * @param callbackArg Argument to pass to the callback
+ * @param[out] ticket Ticket of the operation
+ *
+ * @retval SysStatus_Success Request sent
+ * @retval SysStatus_NoSlotAvailable Too many outstanding operations
+ */
+SysStatus us_tinyAES_DecryptAsync(uint32_t sessionID,
+                                  uint8_t* cipherData, uint32_t cipherDataLen,
+                                  uint8_t* plainData, uint32_t plainDataLen,
+                                  usTinyAESCallback callback, void* callbackArg,
+                                  usTinyAESTicket* ticket);
+
+/*
+ * Processes the received responses of asynchronous operations without
+ * blocking, and checks whether an operation is completed.
+ *
+ * A completed ticket is released by this call. Operations with a callback
+ * are completed via the callback instead.
+ *
+ * @param ticket Ticket to check; US_TINYAES_TICKET_NONE to only process the responses
+ * @param[out] completed Whether the operation is completed
+ * @param[out] usStatus tinyAES Specific Status/Error of the completed operation
+ *
+ * @retval SysStatus_InvalidParameter Invalid or already released ticket
+ * @return SysStatus of the completed operation, otherwise SysStatus_Success
+ */
+SysStatus us_tinyAES_Poll(usTinyAESTicket ticket, bool* completed, usTinyAESStatus* usStatus);
+
+/*
+ * Waits for an asynchronous operation to complete
+ *
+ * See us_tinyAES_Poll()
+ *
+ * @param ticket Ticket of the operation
+ * @param timeoutInMs Timeout; the operation is still outstanding on timeout
+ * @param[out] usStatus tinyAES Specific Status/Error of the operation
+ *
+ * @retval SysStatus_Timeout Operation not completed in time
+ * @retval SysStatus_InvalidParameter Invalid or already released ticket
+ * @return SysStatus of the operation
+ */
+SysStatus us_tinyAES_Wait(usTinyAESTicket ticket, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Sets the priority lane of the subsequent requests of a session; the
+ * Encryption/Decryption, IV and close requests. Requests without a session
+ * use usTinyAESPriority_Default. A session starts with the default.
+ *
+ * The Microservice always serves the higher lanes first: control, then
+ * express, interactive and bulk. Small requests of the interactive and bulk
+ * lanes are served in the express lane, so single block operations do not
+ * wait behind large jobs. Requests of a caller are processed in order within
+ * a lane only.
+ *
+ * Lanes exist only when the Microservice is built with
+ * CFG_US_TINYAES_NUM_OF_WORKERS > 0; otherwise requests are processed in the
+ * order they are received and the priority has no effect.
+ *
+ * @param sessionID Session Handle
+ * @param priority Priority lane
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @retval SysStatus_InvalidParameter Unknown priority
+ * @return SysStatus
+ */
+SysStatus us_tinyAES_SetSessionPriority(uint32_t sessionID, usTinyAESPriority priority, uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Opens a stateless session; the session state (key and IV) is sealed into a
+ * ticket held by the caller instead of a session slot in the Microservice, so
+ * the number of such sessions is not limited by the Session Table.
+ *
+ * The ticket is encrypted and authenticated with a key derived from the
+ * device secret for the current boot of the Microservice, and is bound to the
+ * caller. Every Encryption/Decryption with the ticket updates it for the CBC
+ * chaining; always use the latest one. Nothing is kept in the Microservice,
+ * so there is nothing to close. A ticket is rejected with
+ * usTinyAESOp_InvalidSession after the Microservice restarts; open a new one.
+ *
+ * Tickets are available when the Microservice is built with
+ * CFG_US_TINYAES_SESSION_TICKETS.
+ *
+ * @param algorithm AES Algorithm See usTinyAESAlg
+ * @param key AES Key
+ * @param iv AES Initialisation Vector
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] ticket Session Ticket
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus_Success on successful IPC communication, otherwise IPC error.
+ */
+SysStatus us_tinyAES_OpenSessionTicket(usTinyAESAlg algorithm,
+                                       uint8_t* key, uint32_t keyLen,
+                                       uint8_t* iv, uint32_t ivLen,
+                                       uint32_t timeoutInMs,
+                                       usTinyAESSessionTicket* ticket,
+                                       usTinyAESStatus* usStatus);
+
+/*
+ * Encrypts with a session ticket. See us_tinyAES_OpenSessionTicket()
+ *
+ * @param[in,out] ticket Session Ticket; updated on success
+ * @param plainData Plaindata to encrypt; multiple of AES block size (16 bytes)
+ * @param[out] cipherData Encrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus_Success on successful IPC communication, otherwise IPC error.
+ */
+SysStatus us_tinyAES_EncryptWithSessionTicket(usTinyAESSessionTicket* ticket,
+                                              uint8_t* plainData, uint32_t plainDataLen,
+                                              uint8_t* cipherData, uint32_t cipherDataLen,
+                                              uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
+/*
+ * Decrypts with a session ticket. See us_tinyAES_OpenSessionTicket()
+ *
+ * @param[in,out] ticket Session Ticket; updated on success
+ * @param cipherData Encrypted data; multiple of AES block size (16 bytes)
+ * @param[out] plainData Decrypted Output
+ * @param timeoutInMs Timeout for the blocker operation
+ * @param[out] usStatus tinyAES Specific Status/Error
+ *
+ * @return SysStatus_Success on successful IPC communication, otherwise IPC error.
+ */
+SysStatus us_tinyAES_DecryptWithSessionTicket(usTinyAESSessionTicket* ticket,
+                                              uint8_t* cipherData, uint32_t cipherDataLen,
+                                              uint8_t* plainData, uint32_t plainDataLen,
+                                              uint32_t timeoutInMs, usTinyAESStatus* usStatus);
+
 #endif /* __US_TINYAES_H */
@@ -17,15 +17,508 @@
 /***************************** MACRO DEFINITIONS ******************************/
 
 #ifndef CFG_US_TINYAES_MAX_NUM_OF_SESSION
-#define CFG_US_TINYAES_MAX_NUM_OF_SESSION       1
+#define CFG_US_TINYAES_MAX_NUM_OF_SESSION       4
 #endif /* CFG_US_TINYAES_MAX_NUM_OF_SESSION */
 
+#if CFG_US_TINYAES_MAX_NUM_OF_SESSION < 1 || CFG_US_TINYAES_MAX_NUM_OF_SESSION > 255
+    #error "CFG_US_TINYAES_MAX_NUM_OF_SESSION must be in [1, 255]"
+#endif
+
+/*
+ * Idle sessions are closed by the Microservice, so sessions left open by
+ * crashed clients do not hold the slots forever. The Session Table is swept
+ * with a kernel timer of this period, so a session is closed after being idle
+ * for between one and two periods. A closed session loses its key schedule and
+ * IV chain, so it is disabled by default; with the Session Spill enabled, the
+ * idle sessions are spilled to the storage instead. 0 disables.
+ */
+#ifndef CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS
+#define CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS  (0)
+#endif /* CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS */
+
+/*
+ * Storage offset of the device secret; AES_KEYLEN random bytes provisioned in
+ * the Microcontainer Storage, all the device keys are derived from it. Root
+ * Params are not available to Microservices and the Device UID is not a
+ * secret, so it is required by the features using device keys. A boot counter
+ * follows the secret (see AES_DEVICE_STORAGE_SIZE); it is incremented at every
+ * startup. Not defined by default.
+ */
+/* #define CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET */
+
+/* Device secret and the boot counter; see AESDeviceStorage */
+#define AES_DEVICE_STORAGE_SIZE                 (AES_KEYLEN + 4)
+
+/*
+ * Session Spill; while the Session Table is full, the session to be evicted
+ * (see CFG_US_TINYAES_SESSION_EVICT_IDLE_MS) is sealed with a key of the
+ * current boot and written to the Microcontainer Storage instead of being
+ * closed. It is restored into the Session Table, with one storage read, when
+ * it is used again; spilled sessions do not survive a restart. If the storage
+ * write fails, the session is kept in RAM. Up to this many sessions are kept
+ * in the storage in addition to the sessions in RAM. 0 disables.
+ */
+#ifndef CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION
+#define CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION   0
+#endif /* CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION */
+
+/*
+ * While the Session Table is full, a new session takes the slot of the least
+ * recently used session which has been idle at least this long. Without the
+ * Session Spill the evicted session is closed; its owner loses the session
+ * state (the key schedule and the IV chain) and gets
+ * usTinyAESOp_InvalidSession at its next request, so eviction is off by
+ * default then. With the Session Spill nothing is lost and it is on by
+ * default. 0 disables.
+ */
+#ifndef CFG_US_TINYAES_SESSION_EVICT_IDLE_MS
+    #if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    #define CFG_US_TINYAES_SESSION_EVICT_IDLE_MS    (1000)
+    #else
+    #define CFG_US_TINYAES_SESSION_EVICT_IDLE_MS    (0)
+    #endif
+#endif /* CFG_US_TINYAES_SESSION_EVICT_IDLE_MS */
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+
+    /* Storage offset of the spilled sessions; placed after the device secret by default */
+    #ifndef CFG_US_TINYAES_SPILL_STORAGE_OFFSET
+    #define CFG_US_TINYAES_SPILL_STORAGE_OFFSET \
+                (CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET + AES_DEVICE_STORAGE_SIZE)
+    #endif /* CFG_US_TINYAES_SPILL_STORAGE_OFFSET */
+
+    #if CFG_US_TINYAES_SESSION_EVICT_IDLE_MS == 0
+        #error "CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION needs CFG_US_TINYAES_SESSION_EVICT_IDLE_MS"
+    #endif
+
+#endif
+
+/*
+ * Session Tickets; the session state is sealed into a ticket held by the
+ * caller instead of a session slot. See us_tinyAES_OpenSessionTicket().
+ * 0 disables.
+ */
+#ifndef CFG_US_TINYAES_SESSION_TICKETS
+#define CFG_US_TINYAES_SESSION_TICKETS          0
+#endif /* CFG_US_TINYAES_SESSION_TICKETS */
+
+/* Maximum number of imported keys; see usTinyAESOp_ImportKey */
+#ifndef CFG_US_TINYAES_MAX_NUM_OF_KEY
+#define CFG_US_TINYAES_MAX_NUM_OF_KEY           2
+#endif /* CFG_US_TINYAES_MAX_NUM_OF_KEY */
+
+#if CFG_US_TINYAES_MAX_NUM_OF_KEY < 1 || CFG_US_TINYAES_MAX_NUM_OF_KEY > 255
+    #error "CFG_US_TINYAES_MAX_NUM_OF_KEY must be in [1, 255]"
+#endif
+
+/*
+ * Key Store; keys are sealed with a key derived from the device secret and
+ * kept in the Microcontainer Storage under Stored Key IDs, so they survive
+ * restarts and the raw key is not sent for every session. A stored key is
+ * bound to the Execution Name of its storer. See us_tinyAES_StoreKey().
+ * Up to this many keys. 0 disables.
+ */
+#ifndef CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY
+#define CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY    0
+#endif /* CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY */
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+
+    #if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 255
+        #error "CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY must be in [0, 255]"
+    #endif
+
+    /* Storage offset of the stored keys; placed after the spilled sessions or the device secret by default */
+    #ifndef CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET
+        #if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+        #define CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET \
+                    (CFG_US_TINYAES_SPILL_STORAGE_OFFSET + CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION * US_TINYAES_SESSION_TICKET_SIZE)
+        #else
+        #define CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET \
+                    (CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET + AES_DEVICE_STORAGE_SIZE)
+        #endif
+    #endif /* CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET */
+
+    /*
+     * Number of stored keys kept expanded in RAM. At startup, the most used
+     * keys are expanded before any request arrives; later, a key which is not
+     * in the cache replaces the least recently used one.
+     */
+    #ifndef CFG_US_TINYAES_KEY_STORE_CACHE_SIZE
+    #define CFG_US_TINYAES_KEY_STORE_CACHE_SIZE     2
+    #endif /* CFG_US_TINYAES_KEY_STORE_CACHE_SIZE */
+
+    /*
+     * The usage counters are only a hint for the cache warm up, so they are
+     * written to the storage at most once in this period, when the service
+     * wakes up for a request, to spare the flash. Counts since the last write
+     * are lost on a restart.
+     */
+    #ifndef CFG_US_TINYAES_KEY_STORE_USAGE_SAVE_PERIOD_MS
+    #define CFG_US_TINYAES_KEY_STORE_USAGE_SAVE_PERIOD_MS   (3600000)
+    #endif /* CFG_US_TINYAES_KEY_STORE_USAGE_SAVE_PERIOD_MS */
+
+    #if CFG_US_TINYAES_KEY_STORE_CACHE_SIZE < 1 || \
+        CFG_US_TINYAES_KEY_STORE_CACHE_SIZE > CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY
+        #error "CFG_US_TINYAES_KEY_STORE_CACHE_SIZE must be in [1, CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY]"
+    #endif
+
+#endif
+
+/*
+ * Device Key; an AES key derived from the device secret at startup and kept
+ * expanded. See US_TINYAES_DEVICE_KEY_HANDLE. 0 disables.
+ */
+#ifndef CFG_US_TINYAES_DEVICE_KEY
+#define CFG_US_TINYAES_DEVICE_KEY               0
+#endif /* CFG_US_TINYAES_DEVICE_KEY */
+
+#if CFG_US_TINYAES_DEVICE_KEY
+
+    /*
+     * The Device Key is the same for all its users, so its direct use is
+     * allowed per requester Execution Index, e.g. ((_execIndex) == 3). Nobody
+     * by default. Keys derived from it are bound to the requester and allowed
+     * for all.
+     */
+    #ifndef CFG_US_TINYAES_DEVICE_KEY_ALLOWED
+    #define CFG_US_TINYAES_DEVICE_KEY_ALLOWED(_execIndex)   (0)
+    #endif /* CFG_US_TINYAES_DEVICE_KEY_ALLOWED */
+
+#endif
+
+/*
+ * Key Derivation; child keys are derived from an imported, a stored or the
+ * device key in the Microservice. See us_tinyAES_DeriveKey(). 0 disables.
+ */
+#ifndef CFG_US_TINYAES_KEY_DERIVATION
+#define CFG_US_TINYAES_KEY_DERIVATION           0
+#endif /* CFG_US_TINYAES_KEY_DERIVATION */
+
+/* Device keys seal the state kept out of the Microservice RAM */
+#define AES_USE_SEALING \
+            (CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0 || CFG_US_TINYAES_SESSION_TICKETS || \
+             CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0)
+
+#define AES_USE_DEVICE_KEYS                     (AES_USE_SEALING || CFG_US_TINYAES_DEVICE_KEY)
+
+#if AES_USE_DEVICE_KEYS && !defined(CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET)
+    #error "Session Spill, Session Tickets, Key Store and Device Key need CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET"
+#endif
+
+/*
+ * Storage Layout; the regions may be placed anywhere in the Microcontainer
+ * Storage but must not overlap. Sizes are in bytes.
+ */
+#define AES_SPILL_STORAGE_SIZE \
+            (CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION * US_TINYAES_SESSION_TICKET_SIZE)
+
+/* Sealed keys, usage counters (uint32_t) and generations (uint16_t) */
+#define AES_KEY_STORE_STORAGE_SIZE \
+            (CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY * (US_TINYAES_SESSION_TICKET_SIZE + 4 + 2))
+
+#define AES_STORAGE_OVERLAP(_offset1, _size1, _offset2, _size2) \
+            ((_offset1) < (_offset2) + (_size2) && (_offset2) < (_offset1) + (_size1))
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0 && \
+    AES_STORAGE_OVERLAP(CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET, AES_DEVICE_STORAGE_SIZE, \
+                        CFG_US_TINYAES_SPILL_STORAGE_OFFSET, AES_SPILL_STORAGE_SIZE)
+    #error "Session Spill storage overlaps the device secret"
+#endif
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0 && \
+    AES_STORAGE_OVERLAP(CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET, AES_DEVICE_STORAGE_SIZE, \
+                        CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET, AES_KEY_STORE_STORAGE_SIZE)
+    #error "Key Store storage overlaps the device secret"
+#endif
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0 && CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0 && \
+    AES_STORAGE_OVERLAP(CFG_US_TINYAES_SPILL_STORAGE_OFFSET, AES_SPILL_STORAGE_SIZE, \
+                        CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET, AES_KEY_STORE_STORAGE_SIZE)
+    #error "Key Store storage overlaps the Session Spill storage"
+#endif
+
+/* AES-CMAC for the device keys and the Key Derivation */
+#define AES_USE_CMAC                            (AES_USE_DEVICE_KEYS || CFG_US_TINYAES_KEY_DERIVATION)
+
+/* Stored keys and keys derived from the device key are bound to the requester Execution Name */
+#define AES_USE_SENDER_NAME \
+            (CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0 || (CFG_US_TINYAES_DEVICE_KEY && CFG_US_TINYAES_KEY_DERIVATION))
+
+/*
+ * Number of messages that can be queued in the Microservice message box;
+ * requests beyond the capacity fail with IPCMessageBoxFull on the client side.
+ */
+#ifndef CFG_US_TINYAES_MESSAGEBOX_CAPACITY
+#define CFG_US_TINYAES_MESSAGEBOX_CAPACITY      (2 * CFG_US_TINYAES_MAX_NUM_OF_SESSION)
+#endif /* CFG_US_TINYAES_MESSAGEBOX_CAPACITY */
+
+#if CFG_US_TINYAES_MESSAGEBOX_CAPACITY < 1
+    #error "CFG_US_TINYAES_MESSAGEBOX_CAPACITY must be at least 1"
+#endif
+
+/*
+ * Number of request buffers (jobs) in the pool. A request owns its buffer from
+ * the receive until its response is sent; messages are left in the message
+ * box while the pool is empty.
+ */
+#ifndef CFG_US_TINYAES_NUM_OF_JOBS
+#define CFG_US_TINYAES_NUM_OF_JOBS              2
+#endif /* CFG_US_TINYAES_NUM_OF_JOBS */
+
+#if CFG_US_TINYAES_NUM_OF_JOBS < 1
+    #error "CFG_US_TINYAES_NUM_OF_JOBS must be at least 1"
+#endif
+
+/*
+ * Number of worker threads. With 0, requests are processed in the main thread
+ * while their payload is being received. Otherwise, the main thread receives
+ * and validates the requests and dispatches them to the workers. The priority
+ * lanes and the Fair Queueing below exist only with workers.
+ */
+#ifndef CFG_US_TINYAES_NUM_OF_WORKERS
+#define CFG_US_TINYAES_NUM_OF_WORKERS           0
+#endif /* CFG_US_TINYAES_NUM_OF_WORKERS */
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+
+    /*
+     * Stack of each worker; as the main stack by default. The deepest path is
+     * a key derivation from a stored key, workerThread() -> deriveKeyHandle()
+     * -> getKeySchedule() -> unsealSession() -> updateCMAC() -> Cipher(),
+     * about 1.2 KB on a 64-bit host (see -fstack-usage); measure it again on
+     * the target when it is reduced.
+     */
+    #ifndef CFG_US_TINYAES_WORKER_STACK_SIZE
+    #define CFG_US_TINYAES_WORKER_STACK_SIZE    (0x800)
+    #endif /* CFG_US_TINYAES_WORKER_STACK_SIZE */
+
+    #ifndef CFG_US_TINYAES_WORKER_PRIORITY
+    #define CFG_US_TINYAES_WORKER_PRIORITY      (1)
+    #endif /* CFG_US_TINYAES_WORKER_PRIORITY */
+
+    /* Each worker needs a job to work on */
+    #if CFG_US_TINYAES_NUM_OF_JOBS < CFG_US_TINYAES_NUM_OF_WORKERS
+        #error "CFG_US_TINYAES_NUM_OF_JOBS must be at least CFG_US_TINYAES_NUM_OF_WORKERS"
+    #endif
+
+    /*
+     * Request buffers a requester may hold at once; a request beyond it is
+     * rejected with usTinyAESOp_Busy before its payload is received, so a
+     * flooding requester cannot take all the buffers and keep the others out
+     * of the Fair Queueing. One buffer is left for the others by default.
+     */
+    #ifndef CFG_US_TINYAES_MAX_JOBS_PER_SENDER
+    #define CFG_US_TINYAES_MAX_JOBS_PER_SENDER  (CFG_US_TINYAES_NUM_OF_JOBS > 1 ? CFG_US_TINYAES_NUM_OF_JOBS - 1 : 1)
+    #endif /* CFG_US_TINYAES_MAX_JOBS_PER_SENDER */
+
+    #if CFG_US_TINYAES_MAX_JOBS_PER_SENDER < 1
+        #error "CFG_US_TINYAES_MAX_JOBS_PER_SENDER must be at least 1"
+    #endif
+
+    /*
+     * Fair Queueing; a worker serves the requesters by Deficit Round Robin.
+     * In each round a requester may be served for up to its weight times the
+     * quantum in request bytes, so a requester flooding with large requests
+     * cannot starve the others. The weight is given per requester Execution
+     * Index, e.g. ((_execIndex) == 3 ? 4 : 1).
+     */
+    #ifndef CFG_US_TINYAES_FAIR_QUANTUM
+    #define CFG_US_TINYAES_FAIR_QUANTUM         (256)
+    #endif /* CFG_US_TINYAES_FAIR_QUANTUM */
+
+    #ifndef CFG_US_TINYAES_FAIR_WEIGHT
+    #define CFG_US_TINYAES_FAIR_WEIGHT(_execIndex)  (1)
+    #endif /* CFG_US_TINYAES_FAIR_WEIGHT */
+
+    #if CFG_US_TINYAES_FAIR_QUANTUM < 1
+        #error "CFG_US_TINYAES_FAIR_QUANTUM must be at least 1"
+    #endif
+
+    /*
+     * Requests with a payload up to this length are served in the express
+     * lane. See us_tinyAES_SetSessionPriority()
+     */
+    #ifndef CFG_US_TINYAES_EXPRESS_MAX_LEN
+    #define CFG_US_TINYAES_EXPRESS_MAX_LEN      (64)
+    #endif /* CFG_US_TINYAES_EXPRESS_MAX_LEN */
+
+    /*
+     * Main thread priority; above the workers so that new requests are
+     * received and queued to their lanes while the workers are busy
+     */
+    #ifndef CFG_US_TINYAES_DISPATCHER_PRIORITY
+    #define CFG_US_TINYAES_DISPATCHER_PRIORITY  (CFG_US_TINYAES_WORKER_PRIORITY + 1)
+    #endif /* CFG_US_TINYAES_DISPATCHER_PRIORITY */
+
+#endif
+
+/*
+ * Time slicing without workers; an Encryption/Decryption with more data than
+ * this many blocks is received whole into its request buffer and processed
+ * this many blocks at a time. New requests are received and the other sliced
+ * requests progress between the slices, so a small request does not wait for
+ * a large one to complete. A request buffer is always kept for the requests
+ * processed while received; a request to be queued behind the requests of
+ * its requester is rejected with usTinyAESOp_Busy instead of taking it.
+ * 0 disables.
+ */
+#ifndef CFG_US_TINYAES_SLICE_BLOCKS
+#define CFG_US_TINYAES_SLICE_BLOCKS             (16)
+#endif /* CFG_US_TINYAES_SLICE_BLOCKS */
+
+/*
+ * Queued requests are served earliest deadline first; a requester joins the
+ * round of a worker lane, and the next slice is taken, by the deadline. A
+ * request without a deadline is ordered as if it had this deadline from its
+ * arrival, so requests with deadlines cannot keep it waiting forever.
+ */
+#ifndef CFG_US_TINYAES_NO_DEADLINE_AGING_MS
+#define CFG_US_TINYAES_NO_DEADLINE_AGING_MS     (1000)
+#endif /* CFG_US_TINYAES_NO_DEADLINE_AGING_MS */
+
+/*
+ * Admission Control; a request is rejected with usTinyAESOp_Busy when the
+ * payload bytes of the admitted, not yet completed requests would exceed this
+ * threshold. With workers, requests are rejected as well while the request
+ * buffer pool is empty, instead of being left in the message box. Without
+ * workers, the admitted work is the requests queued for sliced processing,
+ * so it needs CFG_US_TINYAES_SLICE_BLOCKS. 0 disables the Admission Control.
+ */
+#ifndef CFG_US_TINYAES_BUSY_THRESHOLD
+#define CFG_US_TINYAES_BUSY_THRESHOLD           (1024)
+#endif /* CFG_US_TINYAES_BUSY_THRESHOLD */
+
+/* Retry-after hint of a Busy response; scaled by the admitted work */
+#ifndef CFG_US_TINYAES_BUSY_RETRY_AFTER_MS
+#define CFG_US_TINYAES_BUSY_RETRY_AFTER_MS      (5)
+#endif /* CFG_US_TINYAES_BUSY_RETRY_AFTER_MS */
+
+/* A request processed while received is never waiting; see CFG_US_TINYAES_BUSY_THRESHOLD */
+#define AES_USE_ADMISSION \
+            (CFG_US_TINYAES_BUSY_THRESHOLD > 0 && (CFG_US_TINYAES_NUM_OF_WORKERS > 0 || CFG_US_TINYAES_SLICE_BLOCKS > 0))
+
+/*
+ * Requests may be rejected with usTinyAESOp_Busy or usTinyAESOp_Throttled; by
+ * the Admission Control, the request buffer limits of the workers and of the
+ * time slicing, or the Rate Limiting. The User Library retries only then.
+ */
+#define AES_USE_RETRY \
+            (CFG_US_TINYAES_NUM_OF_WORKERS > 0 || CFG_US_TINYAES_SLICE_BLOCKS > 0 || CFG_US_TINYAES_RATE_LIMIT)
+
+/*
+ * User Library backoff on usTinyAESOp_Busy/Throttled; the delay doubles from the base
+ * delay up to the maximum delay on every retry, and it is never less than the
+ * retry-after hint. A message is retried at most
+ * CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS times, and not beyond the call timeout.
+ * The User Library must be built with the configuration of the Microservice;
+ * there is no retry if nothing is rejected (see AES_USE_RETRY).
+ */
+#ifndef CFG_US_TINYAES_BACKOFF_BASE_MS
+#define CFG_US_TINYAES_BACKOFF_BASE_MS          (2)
+#endif /* CFG_US_TINYAES_BACKOFF_BASE_MS */
+
+#ifndef CFG_US_TINYAES_BACKOFF_MAX_MS
+#define CFG_US_TINYAES_BACKOFF_MAX_MS           (100)
+#endif /* CFG_US_TINYAES_BACKOFF_MAX_MS */
+
+#ifndef CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS
+#define CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS     (8)
+#endif /* CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS */
+
+#if CFG_US_TINYAES_BACKOFF_BASE_MS < 1 || CFG_US_TINYAES_BACKOFF_MAX_MS < CFG_US_TINYAES_BACKOFF_BASE_MS
+    #error "CFG_US_TINYAES_BACKOFF_BASE_MS must be in [1, CFG_US_TINYAES_BACKOFF_MAX_MS]"
+#endif
+
+/*
+ * Rate Limiting; each caller has a token bucket for the request bytes and one
+ * for the requests, refilled at the rates given per caller Execution Index.
+ * A request is rejected with usTinyAESOp_Throttled and the refill time when a
+ * bucket runs dry. A bucket holds up to CFG_US_TINYAES_RATE_BURST_MS of its
+ * rate, but at least a single request. A rate of 0 is unlimited.
+ */
+#ifndef CFG_US_TINYAES_RATE_LIMIT
+#define CFG_US_TINYAES_RATE_LIMIT               0
+#endif /* CFG_US_TINYAES_RATE_LIMIT */
+
+#if CFG_US_TINYAES_RATE_LIMIT
+
+    #ifndef CFG_US_TINYAES_RATE_BYTES_PER_SEC
+    #define CFG_US_TINYAES_RATE_BYTES_PER_SEC(_execIndex)   (64 * 1024)
+    #endif /* CFG_US_TINYAES_RATE_BYTES_PER_SEC */
+
+    #ifndef CFG_US_TINYAES_RATE_OPS_PER_SEC
+    #define CFG_US_TINYAES_RATE_OPS_PER_SEC(_execIndex)     (1000)
+    #endif /* CFG_US_TINYAES_RATE_OPS_PER_SEC */
+
+    #ifndef CFG_US_TINYAES_RATE_BURST_MS
+    #define CFG_US_TINYAES_RATE_BURST_MS        (100)
+    #endif /* CFG_US_TINYAES_RATE_BURST_MS */
+
+    /*
+     * Number of callers tracked; an idle caller with full buckets gives its
+     * entry to a new caller, and callers not tracked are not limited
+     */
+    #ifndef CFG_US_TINYAES_MAX_NUM_OF_CLIENTS
+    #define CFG_US_TINYAES_MAX_NUM_OF_CLIENTS   (16)
+    #endif /* CFG_US_TINYAES_MAX_NUM_OF_CLIENTS */
+
+    #if CFG_US_TINYAES_RATE_BURST_MS < 1 || CFG_US_TINYAES_MAX_NUM_OF_CLIENTS < 1
+        #error "CFG_US_TINYAES_RATE_BURST_MS and CFG_US_TINYAES_MAX_NUM_OF_CLIENTS must be at least 1"
+    #endif
+
+#endif
+
+/*
+ * Maximum number of outstanding asynchronous operations of a caller.
+ * See us_tinyAES_EncryptAsync(). The caller Message Box must be able to hold
+ * a response per outstanding operation.
+ */
+#ifndef CFG_US_TINYAES_MAX_NUM_OF_ASYNC
+#define CFG_US_TINYAES_MAX_NUM_OF_ASYNC         4
+#endif /* CFG_US_TINYAES_MAX_NUM_OF_ASYNC */
+
+#if CFG_US_TINYAES_MAX_NUM_OF_ASYNC < 1 || CFG_US_TINYAES_MAX_NUM_OF_ASYNC > 255
+    #error "CFG_US_TINYAES_MAX_NUM_OF_ASYNC must be in [1, 255]"
+#endif
+
+/*
+ * User Library sleeps this long between the polls while waiting for a
+ * response, instead of spinning for the whole timeout. It does not block on
+ * the IPC event, as the event has no timeout and the response may be received
+ * by another thread of the caller.
+ */
+#ifndef CFG_US_TINYAES_POLL_PERIOD_MS
+#define CFG_US_TINYAES_POLL_PERIOD_MS           (1)
+#endif /* CFG_US_TINYAES_POLL_PERIOD_MS */
+
+#if CFG_US_TINYAES_POLL_PERIOD_MS < 1
+    #error "CFG_US_TINYAES_POLL_PERIOD_MS must be at least 1"
+#endif
+
+/*
+ * Receive Buffer Length; the maximum request/response message length.
+ * Must not exceed the Kernel IPC message limit (256 bytes).
+ */
 #ifndef CFG_US_TINYAES_RECEIVE_BUFFER_LEN
 #define CFG_US_TINYAES_RECEIVE_BUFFER_LEN       (256)
 #endif /* CFG_US_TINYAES_RECEIVE_BUFFER_LEN */
 
 #define CFG_US_TINYAES_MAX_RECEIVE_LEN          (CFG_US_TINYAES_RECEIVE_BUFFER_LEN-1)
 
+/*
+ * Encryption/Decryption data is received partially in chunks of this length
+ * and passed to the cipher as soon as it is received.
+ * Must be multiple of AES_BLOCKLEN.
+ */
+#ifndef CFG_US_TINYAES_RECEIVE_CHUNK_LEN
+#define CFG_US_TINYAES_RECEIVE_CHUNK_LEN        (4 * AES_BLOCKLEN)
+#endif /* CFG_US_TINYAES_RECEIVE_CHUNK_LEN */
+
+#if (CFG_US_TINYAES_RECEIVE_CHUNK_LEN % AES_BLOCKLEN) != 0
+    #error "CFG_US_TINYAES_RECEIVE_CHUNK_LEN must be multiple of AES_BLOCKLEN"
+#endif
+
 #ifndef SUPPORT_ONLY_CBC256
 #define SUPPORT_ONLY_CBC256                     1
 #endif
@@ -35,12 +528,88 @@
     #define MAX_KEY_BITLEN                      (256) // CBC256
     #define MAX_KEY_SIZE                        (MAX_KEY_BITLEN / 8)
     #define MAX_IV_SIZE                         (16)
-    #define MAX_BLOCK_SIZE                      (MAX_KEY_BITLEN / 8)
 
 #endif
 
 #define AES_PACKAGE_MAX_SIZE                    sizeof(usTinyAESRequestPackage)
 
+/*
+ * Packages carry an absolute deadline right after the uService header; the
+ * Microservice drops a request when its deadline is passed, as the caller has
+ * already given up on it. The deadline is in Sys_GetTimeInMs() time truncated
+ * to 32 bits, so it is compared wrap-safe only up to AES_DEADLINE_MAX_MS
+ * ahead; a farther deadline is sent as AES_DEADLINE_NONE. The field has no
+ * meaning in the responses.
+ */
+#define AES_PACKAGE_HEAD_SIZE                   (USERVICE_PACKAGE_HEADER_SIZE + sizeof(uint32_t))
+
+#define AES_DEADLINE_NONE                       0
+#define AES_DEADLINE_MAX_MS                     ((uint32_t)0x7FFFFFFF)
+
+/* Wrap-safe deadline comparisons; AES_DEADLINE_NONE never expires and is the latest */
+#define AES_DEADLINE_PASSED(_deadline, _now) \
+            ((_deadline) != AES_DEADLINE_NONE && (int32_t)((uint32_t)(_now) - (uint32_t)(_deadline)) > 0)
+#define AES_DEADLINE_BEFORE(_deadline, _other) \
+            ((_deadline) != AES_DEADLINE_NONE && \
+             ((_other) == AES_DEADLINE_NONE || (int32_t)((uint32_t)(_deadline) - (uint32_t)(_other)) < 0))
+
+/* Fixed part of Encryption/Decryption payload before the data */
+#define AES_ENC_DEC_FIXED_SIZE                  (2 * sizeof(uint32_t))
+
+/*
+ * Maximum data length in a single Encryption/Decryption message; the rest of
+ * the receive buffer rounded down to AES_BLOCKLEN. Longer data is split into
+ * multiple messages by the User Library; CBC chaining continues in the session.
+ */
+#define AES_ENC_DEC_MAX_DATA_LEN \
+            ((((CFG_US_TINYAES_RECEIVE_BUFFER_LEN) - AES_PACKAGE_HEAD_SIZE - AES_ENC_DEC_FIXED_SIZE) / AES_BLOCKLEN) * AES_BLOCKLEN)
+
+/*
+ * Session/Key Handle Layout
+ *
+ *  [31]     Type       : 0 for Session Handles, 1 for Key Handles
+ *  [30]     Stored     : 1 for Stored Key IDs
+ *  [29..16] Generation : Incremented every time the slot is released
+ *  [15..8]  Slot Index : Index in the session/key table
+ *  [7..0]   Owner ID   : Receiver ID of the session/key owner
+ *
+ * A handle can be validated in O(1) by decoding the slot index and comparing
+ * the handle with the one stored in the slot. Generation starts from 1, so a
+ * valid handle is never AES_SESSION_ID_NOT_ACTIVE/AES_KEY_HANDLE_NONE.
+ *
+ * Stored Key IDs are Key Handles with the Stored bit where the slot index is
+ * the index in the Key Store and the generation is persisted per index; they
+ * are the same across restarts. Execution Indexes are not, so the owner of a
+ * stored key is kept in the Key Store and the Owner ID is 0.
+ * US_TINYAES_DEVICE_KEY_HANDLE has the slot index 255, which no table has.
+ */
+#define AES_HANDLE_OWNER_MASK                   ((uint32_t)0x000000FF)
+#define AES_HANDLE_SLOT_SHIFT                   (8)
+#define AES_HANDLE_SLOT_MASK                    ((uint32_t)0x000000FF)
+#define AES_HANDLE_GENERATION_SHIFT             (16)
+#define AES_HANDLE_GENERATION_MASK              ((uint32_t)0x00003FFF)
+#define AES_HANDLE_STORED                       ((uint32_t)0x40000000)
+#define AES_HANDLE_TYPE_KEY                     ((uint32_t)0x80000000)
+
+/* Next generation of a slot; wraps to 1 as 0 is reserved */
+#define AES_HANDLE_NEXT_GENERATION(_generation) \
+            ((uint16_t)(((_generation) % AES_HANDLE_GENERATION_MASK) + 1))
+
+#define AES_HANDLE_MAKE(_generation, _slot, _ownerID) \
+            ((((uint32_t)(_generation) & AES_HANDLE_GENERATION_MASK) << AES_HANDLE_GENERATION_SHIFT) | \
+             (((uint32_t)(_slot) & AES_HANDLE_SLOT_MASK) << AES_HANDLE_SLOT_SHIFT) | \
+             ((uint32_t)(_ownerID) & AES_HANDLE_OWNER_MASK))
+
+#define AES_HANDLE_GET_OWNER(_handle)           ((uint8_t)((_handle) & AES_HANDLE_OWNER_MASK))
+#define AES_HANDLE_GET_SLOT(_handle)            (((_handle) >> AES_HANDLE_SLOT_SHIFT) & AES_HANDLE_SLOT_MASK)
+
+#define AES_HANDLE_GET_GENERATION(_handle)      ((uint16_t)(((_handle) >> AES_HANDLE_GENERATION_SHIFT) & AES_HANDLE_GENERATION_MASK))
+
+#define AES_STORED_KEY_ID(_generation, _index) \
+            (AES_HANDLE_MAKE(_generation, _index, 0) | AES_HANDLE_STORED | AES_HANDLE_TYPE_KEY)
+#define AES_HANDLE_IS_STORED_KEY(_handle) \
+            (((_handle) & (AES_HANDLE_TYPE_KEY | AES_HANDLE_STORED | AES_HANDLE_OWNER_MASK)) == (AES_HANDLE_TYPE_KEY | AES_HANDLE_STORED))
+
 /***************************** TYPE DEFINITIONS *******************************/
 
 typedef struct
@@ -57,61 +626,491 @@ typedef struct
     uint32_t sessionID;
 } usTinyAESPayloadCloseSession;
 
+typedef struct
+{
+    uint32_t alg;
+    uint8_t key[MAX_KEY_SIZE];
+    uint32_t keyLen;
+} usTinyAESPayloadImportKey;
+
+typedef struct
+{
+    uint32_t keyHandle;
+} usTinyAESPayloadReleaseKey;
+
+/*
+ * Derivation of a child key; the label and the context are the inputs of
+ * the SP 800-108 KDF, the label must not contain a zero byte
+ */
+typedef struct
+{
+    uint32_t parentKeyHandle;
+
+    uint32_t labelLen;
+    uint8_t label[US_TINYAES_DERIVE_MAX_LABEL_SIZE];
+
+    uint32_t contextLen;
+    uint8_t context[US_TINYAES_DERIVE_MAX_CONTEXT_SIZE];
+} usTinyAESPayloadDeriveKey;
+
+/* Session parameters referring an imported key instead of the raw key */
+typedef struct
+{
+    uint32_t keyHandle;
+    uint8_t iv[MAX_IV_SIZE];
+    uint32_t ivLen;
+} usTinyAESPayloadOpenSessionWithKey;
+
+/*
+ * Encryption/Decryption payload. Same layout is used for the request and the
+ * response, so the Microservice transforms the data in place.
+ *
+ * If AES_ENC_DEC_FLAG_IV is set in a request, a new IV (MAX_IV_SIZE bytes)
+ * precedes the data and the session IV is reset before the data is processed.
+ * "length" is always the data length excluding the IV. Responses never carry
+ * an IV.
+ */
+#define AES_ENC_DEC_FLAG_IV                     (0x0001)
+
 typedef struct
 {
     uint32_t sessionID;
-    uint32_t length;
-    uint8_t buffer[MAX_BLOCK_SIZE];
+    uint16_t length;
+    uint16_t flags;
+    uint8_t buffer[AES_ENC_DEC_MAX_DATA_LEN];
 } usTinyAESPayloadEncDec;
 
+typedef struct
+{
+    uint32_t sessionID;
+    uint8_t iv[MAX_IV_SIZE];
+    uint32_t ivLen;
+} usTinyAESPayloadSetIV;
+
+typedef struct
+{
+    uint32_t sessionID;
+
+    /* usTinyAESPriority */
+    uint32_t priority;
+} usTinyAESPayloadSetSessionPriority;
+
+/*
+ * Encryption/Decryption with a session ticket; same layout is used for the
+ * request and the response, which carries the updated ticket.
+ */
+#define AES_TICKET_ENC_DEC_FIXED_SIZE           (US_TINYAES_SESSION_TICKET_SIZE + sizeof(uint32_t))
+#define AES_TICKET_ENC_DEC_MAX_DATA_LEN \
+            ((((CFG_US_TINYAES_RECEIVE_BUFFER_LEN) - AES_PACKAGE_HEAD_SIZE - AES_TICKET_ENC_DEC_FIXED_SIZE) / AES_BLOCKLEN) * AES_BLOCKLEN)
+
+typedef struct
+{
+    uint8_t ticket[US_TINYAES_SESSION_TICKET_SIZE];
+    uint32_t length;
+    uint8_t buffer[AES_TICKET_ENC_DEC_MAX_DATA_LEN];
+} usTinyAESPayloadTicketEncDec;
+
+/*
+ * Head of an Encryption/Decryption message; the data follows it directly.
+ * Matches the layout of the usTinyAESRequestPackage::payload::encDec.
+ */
+typedef struct
+{
+    uServicePackageHeader header;
+    uint32_t deadline;
+
+    uint32_t sessionID;
+    uint16_t length;
+    uint16_t flags;
+} usTinyAESEncDecHead;
+
+#define AES_ENC_DEC_HEAD_SIZE                   sizeof(usTinyAESEncDecHead)
+
+/*
+ * One-shot Encryption/Decryption payload; the session parameters followed by
+ * the data. The response has the usTinyAESPayloadEncDec layout.
+ */
+#define AES_ONESHOT_FIXED_SIZE                  (sizeof(usTinyAESPayloadOpenSession) + sizeof(uint32_t))
+#define AES_ONESHOT_MAX_DATA_LEN \
+            ((((CFG_US_TINYAES_RECEIVE_BUFFER_LEN) - AES_PACKAGE_HEAD_SIZE - AES_ONESHOT_FIXED_SIZE) / AES_BLOCKLEN) * AES_BLOCKLEN)
+
+typedef struct
+{
+    usTinyAESPayloadOpenSession params;
+    uint32_t length;
+    uint8_t buffer[AES_ONESHOT_MAX_DATA_LEN];
+} usTinyAESPayloadOneShot;
+
+/* One-shot Encryption/Decryption payload with an imported key */
+#define AES_ONESHOT_WITHKEY_FIXED_SIZE          (sizeof(usTinyAESPayloadOpenSessionWithKey) + sizeof(uint32_t))
+#define AES_ONESHOT_WITHKEY_MAX_DATA_LEN \
+            ((((CFG_US_TINYAES_RECEIVE_BUFFER_LEN) - AES_PACKAGE_HEAD_SIZE - AES_ONESHOT_WITHKEY_FIXED_SIZE) / AES_BLOCKLEN) * AES_BLOCKLEN)
+
+typedef struct
+{
+    usTinyAESPayloadOpenSessionWithKey params;
+    uint32_t length;
+    uint8_t buffer[AES_ONESHOT_WITHKEY_MAX_DATA_LEN];
+} usTinyAESPayloadOneShotWithKey;
+
+/*
+ * Batch payload; "count" items each with an item head followed by the payload
+ * of the item operation (usTinyAESPayloadOpenSession, usTinyAESPayloadOpenSessionWithKey,
+ * usTinyAESPayloadCloseSession, usTinyAESPayloadEncDec).
+ *
+ * The response has the same layout but each item is a result head followed by
+ * the output of the item (session ID for OpenSession, data for Encrypt/Decrypt).
+ *
+ * Items are word aligned; item lengths must be multiple of 4.
+ */
+typedef struct
+{
+    uint16_t operation;
+    uint16_t length;
+} usTinyAESBatchItemHead;
+
+#define AES_BATCH_ITEM_HEAD_SIZE                sizeof(usTinyAESBatchItemHead)
+
+typedef struct
+{
+    int16_t status;
+    uint16_t length;
+} usTinyAESBatchResultHead;
+
+#define AES_BATCH_RESULT_HEAD_SIZE              sizeof(usTinyAESBatchResultHead)
+
+#define AES_BATCH_FIXED_SIZE                    sizeof(uint32_t)
+#define AES_BATCH_MAX_ITEMS_LEN \
+            ((CFG_US_TINYAES_RECEIVE_BUFFER_LEN) - AES_PACKAGE_HEAD_SIZE - AES_BATCH_FIXED_SIZE)
+
+typedef struct
+{
+    uint32_t count;
+    uint8_t items[AES_BATCH_MAX_ITEMS_LEN];
+} usTinyAESPayloadBatch;
+
+/*
+ * Requests carry only the header, the deadline and the used part of the
+ * payload; header.length must be the actual message length.
+ *
+ * header._reserved is a caller assigned request tag; the response carries the
+ * same tag and operation so the caller can match the responses of concurrent
+ * requests.
+ * AES_REQUEST_TAG_NONE is not used as a tag.
+ */
+#define AES_REQUEST_TAG_NONE                    0
+
 typedef struct
 {
     uServicePackageHeader header;
+    uint32_t deadline;
 
     union
     {
-        #define AES_PACKAGE_OPENSESSION_SIZE        (USERVICE_PACKAGE_HEADER_SIZE + sizeof(usTinyAESPayloadOpenSession))
+        #define AES_PACKAGE_OPENSESSION_SIZE        (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadOpenSession))
         usTinyAESPayloadOpenSession openSession;
         
-        #define AES_PACKAGE_CLOSESESSION_SIZE       (USERVICE_PACKAGE_HEADER_SIZE + sizeof(usTinyAESPayloadCloseSession))
+        #define AES_PACKAGE_CLOSESESSION_SIZE       (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadCloseSession))
         usTinyAESPayloadCloseSession closeSession;
         
-        #define AES_PACKAGE_ENC_DEC_SIZE            (USERVICE_PACKAGE_HEADER_SIZE + sizeof(usTinyAESPayloadEncDec))
+        #define AES_PACKAGE_ENC_DEC_SIZE(_dataLen)  (AES_PACKAGE_HEAD_SIZE + AES_ENC_DEC_FIXED_SIZE + (_dataLen))
         usTinyAESPayloadEncDec encDec;
+
+        usTinyAESPayloadBatch batch;
+
+        #define AES_PACKAGE_ONESHOT_SIZE(_dataLen)  (AES_PACKAGE_HEAD_SIZE + AES_ONESHOT_FIXED_SIZE + (_dataLen))
+        usTinyAESPayloadOneShot oneShot;
+
+        #define AES_PACKAGE_IMPORTKEY_SIZE          (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadImportKey))
+        usTinyAESPayloadImportKey importKey;
+
+        #define AES_PACKAGE_RELEASEKEY_SIZE         (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadReleaseKey))
+        usTinyAESPayloadReleaseKey releaseKey;
+
+        /* usTinyAESOp_StoreKey uses importKey and usTinyAESOp_DeleteKey uses releaseKey */
+
+        #define AES_PACKAGE_DERIVEKEY_SIZE          (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadDeriveKey))
+        usTinyAESPayloadDeriveKey deriveKey;
+
+        #define AES_PACKAGE_OPENSESSION_WITHKEY_SIZE (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadOpenSessionWithKey))
+        usTinyAESPayloadOpenSessionWithKey openSessionWithKey;
+
+        #define AES_PACKAGE_ONESHOT_WITHKEY_SIZE(_dataLen) (AES_PACKAGE_HEAD_SIZE + AES_ONESHOT_WITHKEY_FIXED_SIZE + (_dataLen))
+        usTinyAESPayloadOneShotWithKey oneShotWithKey;
+
+        #define AES_PACKAGE_SETIV_SIZE              (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadSetIV))
+        usTinyAESPayloadSetIV setIV;
+
+        #define AES_PACKAGE_SET_SESSION_PRIORITY_SIZE (AES_PACKAGE_HEAD_SIZE + sizeof(usTinyAESPayloadSetSessionPriority))
+        usTinyAESPayloadSetSessionPriority setSessionPriority;
+
+        #define AES_PACKAGE_TICKET_ENC_DEC_SIZE(_dataLen) (AES_PACKAGE_HEAD_SIZE + AES_TICKET_ENC_DEC_FIXED_SIZE + (_dataLen))
+        usTinyAESPayloadTicketEncDec ticketEncDec;
     } payload;
 } usTinyAESRequestPackage;
 
+/*
+ * Responses carry only the header, the deadline and the used part of the payload;
+ * header.length is the actual message length. Error responses are header only.
+ * header._reserved echoes the request tag.
+ */
 typedef struct
 {
     uServicePackageHeader header;
+    uint32_t deadline;
 
     union
     {
+        #define AES_RESPONSE_HANDLE_SIZE            (AES_PACKAGE_HEAD_SIZE + sizeof(uint32_t))
         struct
         {
             uint32_t sessionID;
         } openSession;
-        
+
         struct
         {
-            uint8_t buffer[MAX_BLOCK_SIZE];
-            uint32_t length;
-        } encDec;
+            uint32_t keyHandle;
+        } importKey;
+
+        #define AES_RESPONSE_TICKET_SIZE            (AES_PACKAGE_HEAD_SIZE + US_TINYAES_SESSION_TICKET_SIZE)
+        struct
+        {
+            uint8_t ticket[US_TINYAES_SESSION_TICKET_SIZE];
+        } openSessionTicket;
+
+        /* usTinyAESOp_Busy and usTinyAESOp_Throttled */
+        #define AES_RESPONSE_BUSY_SIZE              (AES_PACKAGE_HEAD_SIZE + sizeof(uint32_t))
+        struct
+        {
+            /* Hint for the caller to retry not earlier than */
+            uint32_t retryAfterMs;
+        } busy;
+        
+        usTinyAESPayloadEncDec encDec;
+
+        usTinyAESPayloadTicketEncDec ticketEncDec;
+
+        usTinyAESPayloadBatch batch;
     } payload;
 } usTinyAESResponsePackage;
 
 typedef struct
 {
     #define AES_SESSION_ID_NOT_ACTIVE               0
+    /* Session Handle, see AES_HANDLE_MAKE() */
     uint32_t id;
-    
+
+    /* Slot generation, survives across open/close to detect stale handles */
+    uint16_t generation;
+
     usTinyAESAlg alg;
-    
+
+    /* Data length must be multiple of the block size */
     uint32_t blockSize;
+
+    /* usTinyAESPriority of the session requests; see us_tinyAES_SetSessionPriority() */
+    uint8_t priority;
+
+    /* Last use (ms) for the idle session reclaim and the LRU eviction */
+    uint64_t lastUsed;
     
     struct AES_ctx ctx;
 } AESSession;
 
+typedef struct
+{
+    #define AES_KEY_HANDLE_NONE                     0
+    /* Key Handle, see AES_HANDLE_MAKE() and AES_HANDLE_TYPE_KEY */
+    uint32_t id;
+
+    /* Slot generation, survives across import/release to detect stale handles */
+    uint16_t generation;
+
+    usTinyAESAlg alg;
+
+    uint32_t blockSize;
+
+    /* Expanded key; sessions copy it and set only their own IV */
+    struct AES_ctx schedule;
+} AESKey;
+
+/*
+ * AES-CMAC (RFC 4493) key; the expanded key and the subkeys
+ */
+typedef struct
+{
+    struct AES_ctx ctx;
+
+    uint8_t k1[AES_BLOCKLEN];
+    uint8_t k2[AES_BLOCKLEN];
+} AESCMAC;
+
+/* AES-CMAC computation in progress; see updateCMAC() */
+typedef struct
+{
+    uint8_t mac[AES_BLOCKLEN];
+
+    /* The last block is kept until it is known to be the last one */
+    uint8_t block[AES_BLOCKLEN];
+    uint32_t blockLen;
+} AESCMACState;
+
+/* Keys to seal a state; AES-CTR for the key and IV, AES-CMAC for the record */
+typedef struct
+{
+    struct AES_ctx encryption;
+    AESCMAC authentication;
+} AESSealingKeys;
+
+/* Device region of the storage; see CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET */
+typedef struct
+{
+    uint8_t secret[AES_KEYLEN];
+
+    /* Incremented at every startup; keys of the boot are derived from it */
+    uint32_t bootCount;
+} AESDeviceStorage;
+
+/*
+ * Sealed session state; a spilled session or a stored key (without an IV) in
+ * the storage, or a session ticket held by the caller. The key and IV are
+ * encrypted with AES-CTR where the counter block starts with the first three
+ * words, and the whole record is authenticated with AES-CMAC; both with device
+ * keys. Its size is US_TINYAES_SESSION_TICKET_SIZE.
+ */
+typedef struct
+{
+    /* Session Handle, Stored Key ID or owner ID of a session ticket */
+    uint32_t id;
+
+    /* Boot counter and the sequence of the sealing, so a counter block is never reused */
+    uint32_t bootCount;
+    uint32_t sequence;
+
+    uint32_t alg;
+    uint32_t blockSize;
+
+    /* Key; the first round key words are the key itself */
+    uint8_t key[AES_KEYLEN];
+
+    /* IV of a session; owner Execution Name of a stored key */
+    uint8_t iv[AES_BLOCKLEN];
+
+    uint8_t tag[AES_BLOCKLEN];
+} AESSealedSession;
+
+/* Authenticated part of a sealed session; all but the tag at the end */
+#define AES_SEALED_SESSION_AUTH_SIZE            (sizeof(AESSealedSession) - AES_BLOCKLEN)
+
+/* Index entry of a spilled session; its place in the storage is its index */
+typedef struct
+{
+    uint32_t id;
+
+    /* Sequence of the sealed record, so an older record is not accepted */
+    uint32_t sequence;
+
+    /* Not sealed; the lane of its requests is found without restoring it */
+    uint8_t priority;
+
+    uint64_t lastUsed;
+} AESSpilledSession;
+
+/* Index entry of a stored key; its place in the storage is its index */
+typedef struct
+{
+    /* Stored Key ID; AES_KEY_HANDLE_NONE if the place is free */
+    uint32_t id;
+
+    /* Sequence of the sealed record, so an older record is not accepted */
+    uint32_t sequence;
+
+    /* Execution Name of the owner; stable across restarts and updates */
+    char owner[SYS_EXEC_NAME_MAX_LENGTH];
+
+    /* Execution Index of the owner in this boot, once resolved from its name */
+    bool ownerResolved;
+    uint8_t ownerID;
+} AESStoredKey;
+
+/* Expanded stored key in the Key Store cache */
+typedef struct
+{
+    /* Stored Key ID; AES_KEY_HANDLE_NONE if the entry is empty */
+    uint32_t id;
+
+    usTinyAESAlg alg;
+
+    uint32_t blockSize;
+
+    /* Last use (ms) to pick the entry to be replaced */
+    uint64_t lastUsed;
+
+    struct AES_ctx schedule;
+} AESCachedKey;
+
+/*
+ * Rate Limiting state of a caller; tokens are kept in thousandths so that
+ * refills of a few milliseconds are not lost to rounding
+ */
+typedef struct
+{
+    bool used;
+    uint8_t senderID;
+
+    uint64_t lastRefill;
+    uint64_t byteTokens;
+    uint64_t opTokens;
+} AESClient;
+
+/*
+ * A request in the service. The response is built in place in the request
+ * buffer, so the same buffer is used for the response.
+ */
+typedef struct AESJob
+{
+    /* Link in the free list */
+    struct AESJob* next;
+
+    uint8_t senderID;
+
+#if AES_USE_SENDER_NAME
+    /* Execution Name of the sender; only received for the operations binding a key to it */
+    char senderName[SYS_EXEC_NAME_MAX_LENGTH];
+#endif
+
+    /* Payload length excluding the header */
+    uint32_t payloadLen;
+
+    /* Offset of the next payload part to read in the package */
+    uint32_t readOffset;
+
+    /* Payload length counted in the admitted work; see CFG_US_TINYAES_BUSY_THRESHOLD */
+    uint32_t admittedLen;
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    /* Queued to or processed by a worker; see CFG_US_TINYAES_MAX_JOBS_PER_SENDER */
+    bool dispatched;
+
+    /* Bitmap of the session slots the job refers to; see dispatchJob() */
+    uint8_t sessionSlots[(CFG_US_TINYAES_MAX_NUM_OF_SESSION + 7) / 8];
+#endif
+
+    /* Deadline in the queue order; see CFG_US_TINYAES_NO_DEADLINE_AGING_MS */
+    uint32_t orderDeadline;
+
+    /* The whole payload is in the package; otherwise it is received while processing */
+    bool buffered;
+
+    /* Sliced processing state; see CFG_US_TINYAES_SLICE_BLOCKS */
+    bool started;
+    uint32_t sequence;
+    uint32_t dataOffset;
+    uint32_t dataLen;
+
+    usTinyAESRequestPackage package;
+} AESJob;
+
 /**************************** FUNCTION PROTOTYPES *****************************/
 
 /******************************** VARIABLES ***********************************/
@@ -15,68 +15,1516 @@
 
 /***************************** MACRO DEFINITIONS ******************************/
 
+/* Ticket layout: generation (bits 23..8) | slot (bits 7..0); never US_TINYAES_TICKET_NONE */
+#define ASYNC_TICKET(slot, generation)      ((((uint32_t)(generation)) << 8) | (uint32_t)(slot))
+#define ASYNC_TICKET_SLOT(ticket)           ((ticket) & 0xFF)
+#define ASYNC_TICKET_GENERATION(ticket)     (((ticket) >> 8) & 0xFFFF)
+
+#define ASYNC_SLOT_NONE                     (0xFF)
+
+#if AES_USE_RETRY
+/* Rejections with a retry-after hint; the request is retried with backoff */
+#define IS_RETRYABLE(status)                ((status) == usTinyAESOp_Busy || (status) == usTinyAESOp_Throttled)
+#else
+/* The Microservice never rejects a request for a retry */
+#define IS_RETRYABLE(status)                (false)
+#endif
+
 /***************************** TYPE DEFINITIONS *******************************/
+
+/* Region headroom must be able to hold an Encryption/Decryption message head */
+typedef char uS_RegionHeadroomCheck[(US_TINYAES_REGION_HEADROOM >= AES_ENC_DEC_HEAD_SIZE) ? 1 : -1];
+
+/*
+ * A request waiting for its response. The response with the same tag and
+ * operation is received into head, and the part of it after head directly
+ * into data.
+ */
+typedef struct uS_Waiter
+{
+    struct uS_Waiter* next;
+
+    uint16_t tag;
+    int16_t operation;
+    bool received;
+
+    uint8_t* head;
+    uint32_t headLen;
+    uint8_t* data;
+    uint32_t dataLen;
+
+    /* Length of the received response */
+    uint32_t responseLen;
+} uS_Waiter;
+
+typedef enum
+{
+    uS_AsyncState_Free = 0,
+    uS_AsyncState_Queued,
+    uS_AsyncState_Pending,
+    uS_AsyncState_Backoff,
+    uS_AsyncState_Completed,
+} uS_AsyncState;
+
+typedef struct
+{
+    uint8_t state;
+    bool encrypt;
+    uint16_t generation;
+
+    /*
+     * Next operation on the same session; it is started when this one completes
+     * so the messages of a session are not interleaved in the CBC chain
+     */
+    uint8_t next;
+
+    uint32_t sessionID;
+    uint8_t* input;
+    uint8_t* output;
+    uint32_t length;
+
+    /* Processed length, and the length of the message in flight */
+    uint32_t offset;
+    uint32_t chunkLen;
+
+    /* Response of the message in flight */
+    uS_Waiter waiter;
+    usTinyAESEncDecHead head;
+
+    /* Retries of the rejected message in flight; it is resent at retryAt */
+    uint32_t attempts;
+    uint64_t retryAt;
+
+    SysStatus retVal;
+    usTinyAESStatus usStatus;
+
+    usTinyAESCallback callback;
+    void* callbackArg;
+} uS_AsyncOperation;
+
 typedef struct
 {
-    struct
+    struct
+    {
+        uint32_t initialised        : 1;
+    } flags;
+
+    /*
+     * The "Execution Index" is a system wide enumaration by the Microservice Runtime
+     * to interact with the Microservice.
+     */
+    uint32_t execIndex;
+
+    /* IPC Destination ID of the Microservice for the direct messaging */
+    uint32_t serviceID;
+
+    /* Registered Region for in-place operations */
+    struct
+    {
+        uint8_t* buffer;
+        uint32_t length;
+    } region;
+
+    /*
+     * Requests waiting for their responses, from all threads of the caller and
+     * the asynchronous operations. Any thread receiving a response passes it
+     * to its waiter by the request tag.
+     */
+    uS_Waiter* waiters;
+    uint16_t lastTag;
+
+    /* Backoff jitter generator state */
+    uint32_t jitterState;
+
+    /* Asynchronous Operations */
+    struct
+    {
+        uS_AsyncOperation operations[CFG_US_TINYAES_MAX_NUM_OF_ASYNC];
+    } async;
+} uS_UserLibSettings;
+
+/**************************** FUNCTION PROTOTYPES *****************************/
+
+/******************************** VARIABLES ***********************************/
+PRIVATE uS_UserLibSettings userLibSettings;
+
+PRIVATE const char usName[SYS_EXEC_NAME_MAX_LENGTH] = USERVICE_NAME;
+
+/***************************** PRIVATE FUNCTIONS *******************************/
+
+/*
+ * Drops the unprocessed part of the current message
+ */
+static void discardMessage(uint32_t len)
+{
+    uint8_t chunk[16];
+    uint8_t senderID;
+    uint32_t sequenceNo;
+    uint32_t chunkLen;
+
+    while (len > 0)
+    {
+        chunkLen = len < sizeof(chunk) ? len : sizeof(chunk);
+        if (Sys_ReceiveMessage(&senderID, chunk, chunkLen, &sequenceNo) != SysStatus_Success)
+        {
+            break;
+        }
+        len -= chunkLen;
+    }
+}
+
+/*
+ * Checks whether a tag is used by a waiting request; a late response of a
+ * request sent a tag wrap ago must not reach a new request.
+ * Must be called in the critical section.
+ */
+static bool isTagWaiting(uint16_t tag)
+{
+    uS_Waiter* waiter;
+
+    for (waiter = userLibSettings.waiters; waiter != NULL; waiter = waiter->next)
+    {
+        if (waiter->tag == tag)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Initialises a waiter with a new request tag, not used by any waiting request
+ *
+ * @param[out] waiter Waiter
+ * @param[out] head Buffer for the first part of the response; at least a header
+ * @param headLen Length of the first part
+ * @param[out] data Buffer for the rest of the response; NULL if not needed
+ * @param dataLen Length of the data buffer
+ */
+static void initialiseWaiter(uS_Waiter* waiter, uint8_t* head, uint32_t headLen, uint8_t* data, uint32_t dataLen)
+{
+    Sys_EnterCriticalSection();
+    {
+        do
+        {
+            if (++userLibSettings.lastTag == AES_REQUEST_TAG_NONE)
+            {
+                ++userLibSettings.lastTag;
+            }
+        } while (isTagWaiting(userLibSettings.lastTag));
+
+        waiter->tag = userLibSettings.lastTag;
+    }
+    Sys_ExitCriticalSection();
+
+    waiter->next = NULL;
+    waiter->received = false;
+    waiter->head = head;
+    waiter->headLen = headLen;
+    waiter->data = data;
+    waiter->dataLen = dataLen;
+    waiter->responseLen = 0;
+}
+
+/*
+ * Sends a request tagged with the waiter tag and registers the waiter
+ */
+static SysStatus sendTagged(uS_Waiter* waiter, uint8_t* message, uint32_t messageLen)
+{
+    SysStatus retVal;
+    uint32_t sequenceNo;
+
+    waiter->operation = ((uServicePackageHeader*)message)->operation;
+
+    Sys_EnterCriticalSection();
+    {
+        retVal = Sys_SendMessage((uint8_t)userLibSettings.serviceID, message, messageLen, &sequenceNo);
+        if (retVal == SysStatus_Success)
+        {
+            waiter->next = userLibSettings.waiters;
+            userLibSettings.waiters = waiter;
+        }
+    }
+    Sys_ExitCriticalSection();
+
+    return retVal;
+}
+
+/*
+ * Removes a waiter if it is still waiting
+ *
+ * @retval true The waiter was waiting
+ * @retval false The waiter has already received its response
+ */
+static bool removeWaiter(uS_Waiter* waiter)
+{
+    uS_Waiter** link;
+    bool removed = false;
+
+    Sys_EnterCriticalSection();
+    {
+        for (link = &userLibSettings.waiters; *link != NULL; link = &(*link)->next)
+        {
+            if (*link == waiter)
+            {
+                *link = waiter->next;
+                removed = true;
+                break;
+            }
+        }
+    }
+    Sys_ExitCriticalSection();
+
+    return removed;
+}
+
+/*
+ * Receives a message, if any, and passes it to the waiter of its tag and
+ * operation, whichever request of the caller it answers and in whatever order
+ * the responses arrive. Messages without a waiter, e.g. late responses of
+ * timed out requests, are dropped. Must be called in the critical section.
+ *
+ * @retval true A message is processed
+ * @retval false No message received
+ */
+static bool dispatchResponse(void)
+{
+    uServicePackageHeader header;
+    uS_Waiter** link;
+    uS_Waiter* waiter;
+    bool messageReceived = false;
+    uint32_t messageLen;
+    uint32_t remainingLen;
+    uint32_t len;
+    uint32_t sequenceNo;
+    uint8_t senderID;
+
+    (void)Sys_IsMessageReceived(&messageReceived, &messageLen, &sequenceNo);
+    if (!messageReceived || messageLen == 0)
+    {
+        return false;
+    }
+
+    if (messageLen < USERVICE_PACKAGE_HEADER_SIZE)
+    {
+        discardMessage(messageLen);
+        return true;
+    }
+
+    (void)Sys_ReceiveMessage(&senderID, (uint8_t*)&header, USERVICE_PACKAGE_HEADER_SIZE, &sequenceNo);
+    remainingLen = messageLen - USERVICE_PACKAGE_HEADER_SIZE;
+
+    for (link = &userLibSettings.waiters; *link != NULL; link = &(*link)->next)
+    {
+        if ((*link)->tag == header._reserved && (*link)->operation == header.operation)
+        {
+            break;
+        }
+    }
+
+    waiter = *link;
+    if (waiter == NULL || senderID != userLibSettings.serviceID)
+    {
+        discardMessage(remainingLen);
+        return true;
+    }
+
+    *link = waiter->next;
+
+    memcpy(waiter->head, &header, USERVICE_PACKAGE_HEADER_SIZE);
+
+    len = remainingLen < waiter->headLen - USERVICE_PACKAGE_HEADER_SIZE ? remainingLen : waiter->headLen - USERVICE_PACKAGE_HEADER_SIZE;
+    if (len > 0)
+    {
+        (void)Sys_ReceiveMessage(&senderID, &waiter->head[USERVICE_PACKAGE_HEADER_SIZE], len, &sequenceNo);
+        remainingLen -= len;
+    }
+
+    len = remainingLen < waiter->dataLen ? remainingLen : waiter->dataLen;
+    if (waiter->data != NULL && len > 0)
+    {
+        (void)Sys_ReceiveMessage(&senderID, waiter->data, len, &sequenceNo);
+        remainingLen -= len;
+    }
+
+    discardMessage(remainingLen);
+
+    waiter->responseLen = messageLen;
+    waiter->received = true;
+
+    return true;
+}
+
+/*
+ * Passes all received messages to their waiters
+ */
+static void dispatchResponses(void)
+{
+    Sys_EnterCriticalSection();
+    while (dispatchResponse())
+    {
+    }
+    Sys_ExitCriticalSection();
+}
+
+/*
+ * Waits until the given time for the response of a sent request. Responses of
+ * other requests received meanwhile are passed to their waiters.
+ */
+static SysStatus waitResponse(uS_Waiter* waiter, uint64_t timeout)
+{
+    while (true)
+    {
+        dispatchResponses();
+
+        if (waiter->received)
+        {
+            return SysStatus_Success;
+        }
+
+        if (Sys_GetTimeInMs() > timeout)
+        {
+            break;
+        }
+
+        (void)Sys_Sleep(CFG_US_TINYAES_POLL_PERIOD_MS);
+    }
+
+    /* The response may have been received just now by another thread */
+    return removeWaiter(waiter) ? SysStatus_Timeout : SysStatus_Success;
+}
+
+/*
+ * Deadline of a request for the given timeout time; see AES_PACKAGE_HEAD_SIZE.
+ * A timeout beyond AES_DEADLINE_MAX_MS would wrap into the past, so the
+ * request is sent without a deadline instead.
+ */
+static uint32_t getDeadline(uint64_t timeout)
+{
+    uint32_t deadline = (uint32_t)timeout;
+    uint64_t now = Sys_GetTimeInMs();
+
+    if (timeout > now && timeout - now > AES_DEADLINE_MAX_MS)
+    {
+        return AES_DEADLINE_NONE;
+    }
+
+    return deadline != AES_DEADLINE_NONE ? deadline : deadline + 1;
+}
+
+/*
+ * Backoff delay before the given retry of a rejected request; doubles
+ * on each attempt up to CFG_US_TINYAES_BACKOFF_MAX_MS but is never shorter than
+ * the retry-after hint of the Microservice. Up to 50% jitter is added so the
+ * rejected callers do not retry all at once.
+ */
+static uint32_t getBackoffDelay(uint32_t attempt, uint32_t retryAfterMs)
+{
+    uint32_t delay = CFG_US_TINYAES_BACKOFF_BASE_MS;
+    uint32_t jitter;
+
+    while (attempt-- > 0 && delay < CFG_US_TINYAES_BACKOFF_MAX_MS)
+    {
+        delay <<= 1;
+    }
+
+    if (delay > CFG_US_TINYAES_BACKOFF_MAX_MS)
+    {
+        delay = CFG_US_TINYAES_BACKOFF_MAX_MS;
+    }
+
+    if (delay < retryAfterMs)
+    {
+        delay = retryAfterMs;
+    }
+
+    /* xorshift32; seeded per caller so the callers are not in lockstep */
+    Sys_EnterCriticalSection();
+    {
+        if (userLibSettings.jitterState == 0)
+        {
+            userLibSettings.jitterState = ((uint32_t)Sys_GetTimeInMs() ^ (userLibSettings.execIndex << 16)) | 1;
+        }
+
+        userLibSettings.jitterState ^= userLibSettings.jitterState << 13;
+        userLibSettings.jitterState ^= userLibSettings.jitterState >> 17;
+        userLibSettings.jitterState ^= userLibSettings.jitterState << 5;
+
+        jitter = userLibSettings.jitterState % (delay / 2 + 1);
+    }
+    Sys_ExitCriticalSection();
+
+    return delay + jitter;
+}
+
+/*
+ * Retry-after hint of a Busy/Throttled response, if the response carries it
+ */
+static uint32_t getRetryAfter(uS_Waiter* waiter)
+{
+    uint32_t retryAfterMs = 0;
+
+    if (waiter->responseLen >= AES_RESPONSE_BUSY_SIZE && waiter->headLen >= AES_RESPONSE_BUSY_SIZE)
+    {
+        memcpy(&retryAfterMs, &waiter->head[AES_PACKAGE_HEAD_SIZE], sizeof(retryAfterMs));
+    }
+
+    return retryAfterMs;
+}
+
+/*
+ * Sleeps before retrying a request rejected as Busy/Throttled
+ *
+ * @param waiter Waiter with the rejection response
+ * @param attempt Number of the retries so far
+ * @param timeout Time the caller gives up
+ *
+ * @retval true Retry the request
+ * @retval false Give up; no attempts left or the retry would be too late
+ */
+static bool backoff(uS_Waiter* waiter, uint32_t attempt, uint64_t timeout)
+{
+    uint32_t delay;
+
+    if (attempt >= CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS)
+    {
+        return false;
+    }
+
+    delay = getBackoffDelay(attempt, getRetryAfter(waiter));
+    if (Sys_GetTimeInMs() + delay >= timeout)
+    {
+        return false;
+    }
+
+    Sys_Sleep(delay);
+
+    return true;
+}
+
+/*
+ * Sends a request and waits for its response. The request is retried with
+ * backoff while the Microservice rejects it as Busy or Throttled.
+ */
+static SysStatus sendRequest(usTinyAESRequestPackage* request, usTinyAESResponsePackage* response, uint32_t timeoutInMs)
+{
+    SysStatus retVal;
+    uS_Waiter waiter;
+    uint64_t timeout = Sys_GetTimeInMs() + timeoutInMs;
+    uint32_t attempt = 0;
+
+    do
+    {
+        initialiseWaiter(&waiter, (uint8_t*)response, sizeof(*response), NULL, 0);
+
+        request->header.status = usTinyAESOp_Success;
+        request->header._reserved = waiter.tag;
+        request->deadline = getDeadline(timeout);
+
+        response->header.status = usTinyAESOp_Success;
+
+        retVal = sendTagged(&waiter, (uint8_t*)request, request->header.length);
+        if (retVal == SysStatus_Success)
+        {
+            retVal = waitResponse(&waiter, timeout);
+        }
+    } while (retVal == SysStatus_Success &&
+             IS_RETRYABLE(response->header.status) &&
+             backoff(&waiter, attempt++, timeout));
+
+    if (retVal == SysStatus_Timeout)
+    {
+        response->header.status = usTinyAESOp_Timeout;
+    }
+
+    return retVal;
+}
+
+/*
+ * Encrypts/Decrypts the input. Input longer than a single message can carry
+ * is sent in multiple messages; as the session keeps the CBC chaining state,
+ * the result is same with a single message.
+ *
+ * If iv is not NULL, it is sent in the first message to reset the session IV.
+ */
+static SysStatus encdec(bool enc, uint32_t sessionID, uint8_t* iv, uint32_t ivLen, uint8_t* input, uint32_t inputLen, uint8_t* output, uint32_t outputLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal = SysStatus_Success;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+    uint32_t offset;
+    uint32_t chunkLen;
+    uint32_t maxChunkLen;
+
+    *usStatus = usTinyAESOp_Success;
+
+    if (outputLen < inputLen)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+        return SysStatus_InvalidSize;
+    }
+
+    if (iv != NULL && ivLen != MAX_IV_SIZE)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
+
+    for (offset = 0; offset < inputLen; offset += chunkLen)
+    {
+        uint32_t ivOffset = 0;
+
+        request.payload.encDec.flags = 0;
+        maxChunkLen = AES_ENC_DEC_MAX_DATA_LEN;
+
+        /* Only the first message resets the IV; the rest continues the chain */
+        if (iv != NULL && offset == 0)
+        {
+            request.payload.encDec.flags = AES_ENC_DEC_FLAG_IV;
+            memcpy(request.payload.encDec.buffer, iv, MAX_IV_SIZE);
+            ivOffset = MAX_IV_SIZE;
+            maxChunkLen -= MAX_IV_SIZE;
+        }
+
+        chunkLen = (inputLen - offset) < maxChunkLen ? (inputLen - offset) : maxChunkLen;
+
+        {
+            request.header.operation = enc ? usTinyAESOp_Encrypt : usTinyAESOp_Decrypt;
+            request.header.length = AES_PACKAGE_ENC_DEC_SIZE(ivOffset + chunkLen);
+            request.payload.encDec.sessionID = sessionID;
+            request.payload.encDec.length = (uint16_t)chunkLen;
+
+            memcpy(&request.payload.encDec.buffer[ivOffset], &input[offset], chunkLen);
+        }
+
+        retVal = sendRequest(&request, &response, timeoutInMs);
+        if (retVal != SysStatus_Success)
+        {
+            break;
+        }
+
+        *usStatus = response.header.status;
+        if (response.header.status != usTinyAESOp_Success)
+        {
+            break;
+        }
+
+        if (response.header.length != AES_PACKAGE_ENC_DEC_SIZE(chunkLen) ||
+            response.payload.encDec.length != chunkLen)
+        {
+            *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+            break;
+        }
+
+        memcpy(&output[offset], response.payload.encDec.buffer, chunkLen);
+    }
+
+    return retVal;
+}
+
+/*
+ * Encrypts/Decrypts the input with a session ticket. Input longer than a single
+ * message can carry is sent in multiple messages, each with the ticket updated
+ * by the previous one. The caller's ticket is updated only when all succeed.
+ */
+static SysStatus ticketEncDec(bool enc, usTinyAESSessionTicket* ticket, uint8_t* input, uint32_t inputLen, uint8_t* output, uint32_t outputLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal = SysStatus_Success;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+    uint32_t offset;
+    uint32_t chunkLen;
+
+    *usStatus = usTinyAESOp_Success;
+
+    if (outputLen < inputLen)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+        return SysStatus_InvalidSize;
+    }
+
+    memcpy(request.payload.ticketEncDec.ticket, ticket->data, US_TINYAES_SESSION_TICKET_SIZE);
+
+    for (offset = 0; offset < inputLen; offset += chunkLen)
+    {
+        chunkLen = (inputLen - offset) < AES_TICKET_ENC_DEC_MAX_DATA_LEN ? (inputLen - offset) : AES_TICKET_ENC_DEC_MAX_DATA_LEN;
+
+        {
+            request.header.operation = enc ? usTinyAESOp_EncryptWithSessionTicket : usTinyAESOp_DecryptWithSessionTicket;
+            request.header.length = AES_PACKAGE_TICKET_ENC_DEC_SIZE(chunkLen);
+            request.payload.ticketEncDec.length = chunkLen;
+
+            memcpy(request.payload.ticketEncDec.buffer, &input[offset], chunkLen);
+        }
+
+        retVal = sendRequest(&request, &response, timeoutInMs);
+        if (retVal != SysStatus_Success)
+        {
+            break;
+        }
+
+        *usStatus = response.header.status;
+        if (response.header.status != usTinyAESOp_Success)
+        {
+            break;
+        }
+
+        if (response.header.length != AES_PACKAGE_TICKET_ENC_DEC_SIZE(chunkLen) ||
+            response.payload.ticketEncDec.length != chunkLen)
+        {
+            *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+            break;
+        }
+
+        memcpy(&output[offset], response.payload.ticketEncDec.buffer, chunkLen);
+
+        /* Next message continues with the updated ticket */
+        memcpy(request.payload.ticketEncDec.ticket, response.payload.ticketEncDec.ticket, US_TINYAES_SESSION_TICKET_SIZE);
+    }
+
+    if (retVal == SysStatus_Success && *usStatus == usTinyAESOp_Success)
+    {
+        memcpy(ticket->data, request.payload.ticketEncDec.ticket, US_TINYAES_SESSION_TICKET_SIZE);
+    }
+
+    return retVal;
+}
+
+/*
+ * One-shot Encryption/Decryption with the raw key, or with an imported key if
+ * keyHandle is not AES_KEY_HANDLE_NONE. Input longer than a single message can
+ * carry is sent in multiple messages; the IV of each message is the last cipher
+ * block of the previous message so the result is same with a single message.
+ */
+static SysStatus oneShot(bool enc, uint32_t keyHandle, usTinyAESAlg algorithm,
+                         uint8_t* key, uint32_t keyLen,
+                         uint8_t* iv, uint32_t ivLen,
+                         uint8_t* input, uint32_t inputLen,
+                         uint8_t* output, uint32_t outputLen,
+                         uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal = SysStatus_Success;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+    uint8_t* requestIV;
+    uint8_t* requestBuffer;
+    uint32_t* requestLength;
+    uint32_t fixedSize;
+    uint32_t maxDataLen;
+    int16_t operation;
+    uint32_t offset;
+    uint32_t chunkLen;
+
+    *usStatus = usTinyAESOp_Success;
+
+    if (keyLen > MAX_KEY_SIZE || ivLen > MAX_IV_SIZE)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
+
+    if (outputLen < inputLen)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+        return SysStatus_InvalidSize;
+    }
+
+    if (keyHandle != AES_KEY_HANDLE_NONE)
+    {
+        request.payload.oneShotWithKey.params.keyHandle = keyHandle;
+        request.payload.oneShotWithKey.params.ivLen = ivLen;
+
+        requestIV = request.payload.oneShotWithKey.params.iv;
+        requestBuffer = request.payload.oneShotWithKey.buffer;
+        requestLength = &request.payload.oneShotWithKey.length;
+        fixedSize = AES_ONESHOT_WITHKEY_FIXED_SIZE;
+        maxDataLen = AES_ONESHOT_WITHKEY_MAX_DATA_LEN;
+        operation = enc ? usTinyAESOp_EncryptOneShotWithKey : usTinyAESOp_DecryptOneShotWithKey;
+    }
+    else
+    {
+        request.payload.oneShot.params.alg = algorithm;
+        request.payload.oneShot.params.keyLen = keyLen;
+        request.payload.oneShot.params.ivLen = ivLen;
+        memcpy(request.payload.oneShot.params.key, key, keyLen);
+
+        requestIV = request.payload.oneShot.params.iv;
+        requestBuffer = request.payload.oneShot.buffer;
+        requestLength = &request.payload.oneShot.length;
+        fixedSize = AES_ONESHOT_FIXED_SIZE;
+        maxDataLen = AES_ONESHOT_MAX_DATA_LEN;
+        operation = enc ? usTinyAESOp_EncryptOneShot : usTinyAESOp_DecryptOneShot;
+    }
+
+    memcpy(requestIV, iv, ivLen);
+
+    for (offset = 0; offset < inputLen; offset += chunkLen)
+    {
+        chunkLen = (inputLen - offset) < maxDataLen ? (inputLen - offset) : maxDataLen;
+
+        {
+            request.header.operation = operation;
+            request.header.length = AES_PACKAGE_HEAD_SIZE + fixedSize + chunkLen;
+            *requestLength = chunkLen;
+
+            memcpy(requestBuffer, &input[offset], chunkLen);
+        }
+
+        retVal = sendRequest(&request, &response, timeoutInMs);
+        if (retVal != SysStatus_Success)
+        {
+            break;
+        }
+
+        *usStatus = response.header.status;
+        if (response.header.status != usTinyAESOp_Success)
+        {
+            break;
+        }
+
+        if (response.header.length != AES_PACKAGE_ENC_DEC_SIZE(chunkLen))
+        {
+            *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+            break;
+        }
+
+        memcpy(&output[offset], response.payload.encDec.buffer, chunkLen);
+
+        /* Chain the next message */
+        if (chunkLen >= AES_BLOCKLEN && ivLen == AES_BLOCKLEN)
+        {
+            uint8_t* lastCipherBlock = enc ? &response.payload.encDec.buffer[chunkLen - AES_BLOCKLEN] :
+                                             &requestBuffer[chunkLen - AES_BLOCKLEN];
+
+            memcpy(requestIV, lastCipherBlock, AES_BLOCKLEN);
+        }
+    }
+
+    /* Do not leave the key on the stack */
+    memset(&request.payload, 0, fixedSize);
+
+    return retVal;
+}
+
+/*
+ * Encrypts/Decrypts the registered region in place.
+ *
+ * Each message is assembled in the region; the message head is written just
+ * before the data, and the overwritten bytes are restored right after the
+ * message is sent. The result is received directly over the data, so on a
+ * failure the data before processedLen is processed and the rest is intact.
+ */
+static SysStatus encdecRegion(bool enc, uint32_t sessionID, uint32_t offset, uint32_t length, uint32_t timeoutInMs,
+                              uint32_t* processedLen, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal = SysStatus_Success;
+    usTinyAESEncDecHead head;
+    uS_Waiter waiter;
+    uint8_t savedBytes[AES_ENC_DEC_HEAD_SIZE];
+    uint8_t* data;
+    uint32_t chunkOffset;
+    uint32_t chunkLen;
+    uint32_t attempt;
+    uint64_t timeout;
+
+    *processedLen = 0;
+    *usStatus = usTinyAESOp_Success;
+
+    if (userLibSettings.region.buffer == NULL)
+    {
+        return SysStatus_NotInitialised;
+    }
+
+    if (offset > userLibSettings.region.length - US_TINYAES_REGION_HEADROOM ||
+        length > userLibSettings.region.length - US_TINYAES_REGION_HEADROOM - offset)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+        return SysStatus_InvalidParameter;
+    }
+
+    data = &userLibSettings.region.buffer[US_TINYAES_REGION_HEADROOM + offset];
+
+    for (chunkOffset = 0; chunkOffset < length; chunkOffset += chunkLen)
+    {
+        uint8_t* chunk = &data[chunkOffset];
+        uint8_t* message = chunk - AES_ENC_DEC_HEAD_SIZE;
+
+        chunkLen = (length - chunkOffset) < AES_ENC_DEC_MAX_DATA_LEN ? (length - chunkOffset) : AES_ENC_DEC_MAX_DATA_LEN;
+        timeout = Sys_GetTimeInMs() + timeoutInMs;
+        attempt = 0;
+
+        do
+        {
+            /* The result is received directly over the data; a rejection does not reach it */
+            initialiseWaiter(&waiter, (uint8_t*)&head, AES_ENC_DEC_HEAD_SIZE, chunk, chunkLen);
+
+            {
+                head.header.operation = enc ? usTinyAESOp_Encrypt : usTinyAESOp_Decrypt;
+                head.header.status = usTinyAESOp_Success;
+                head.header.length = AES_PACKAGE_ENC_DEC_SIZE(chunkLen);
+                head.header._reserved = waiter.tag;
+                head.deadline = getDeadline(timeout);
+                head.sessionID = sessionID;
+                head.length = (uint16_t)chunkLen;
+                head.flags = 0;
+            }
+
+            /* Put the head in front of the data; the kernel copies the message during the send */
+            memcpy(savedBytes, message, AES_ENC_DEC_HEAD_SIZE);
+            memcpy(message, &head, AES_ENC_DEC_HEAD_SIZE);
+            retVal = sendTagged(&waiter, message, head.header.length);
+            memcpy(message, savedBytes, AES_ENC_DEC_HEAD_SIZE);
+
+            if (retVal == SysStatus_Success)
+            {
+                retVal = waitResponse(&waiter, timeout);
+            }
+        } while (retVal == SysStatus_Success &&
+                 IS_RETRYABLE(head.header.status) &&
+                 backoff(&waiter, attempt++, timeout));
+
+        if (retVal != SysStatus_Success)
+        {
+            break;
+        }
+
+        *usStatus = (usTinyAESStatus)head.header.status;
+        if (head.header.status != usTinyAESOp_Success ||
+            waiter.responseLen != AES_PACKAGE_ENC_DEC_SIZE(chunkLen) ||
+            head.length != chunkLen)
+        {
+            if (*usStatus == usTinyAESOp_Success)
+            {
+                *usStatus = usTinyAESOp_InvalidOperation;
+            }
+            break;
+        }
+
+        *processedLen = chunkOffset + chunkLen;
+    }
+
+    return retVal;
+}
+
+/*
+ * Sends the next message of an asynchronous operation. The result is received
+ * directly into the output buffer of the operation.
+ * Must be called in the critical section.
+ */
+static SysStatus asyncSend(uint32_t slot)
+{
+    uS_AsyncOperation* operation = &userLibSettings.async.operations[slot];
+    usTinyAESRequestPackage request;
+    uint32_t remainingLen = operation->length - operation->offset;
+
+    operation->chunkLen = remainingLen < AES_ENC_DEC_MAX_DATA_LEN ? remainingLen : AES_ENC_DEC_MAX_DATA_LEN;
+
+    initialiseWaiter(&operation->waiter, (uint8_t*)&operation->head, AES_ENC_DEC_HEAD_SIZE,
+                     &operation->output[operation->offset], operation->chunkLen);
+
+    {
+        request.header.operation = operation->encrypt ? usTinyAESOp_Encrypt : usTinyAESOp_Decrypt;
+        request.header.status = usTinyAESOp_Success;
+        request.header.length = AES_PACKAGE_ENC_DEC_SIZE(operation->chunkLen);
+        request.header._reserved = operation->waiter.tag;
+        request.deadline = AES_DEADLINE_NONE;
+        request.payload.encDec.sessionID = operation->sessionID;
+        request.payload.encDec.length = (uint16_t)operation->chunkLen;
+        request.payload.encDec.flags = 0;
+
+        memcpy(request.payload.encDec.buffer, &operation->input[operation->offset], operation->chunkLen);
+    }
+
+    return sendTagged(&operation->waiter, (uint8_t*)&request, request.header.length);
+}
+
+/*
+ * Completes an asynchronous operation and starts the next operation on the
+ * same session, if any. Must be called in the critical section.
+ */
+static void asyncComplete(uint32_t slot, SysStatus retVal, usTinyAESStatus usStatus)
+{
+    uS_AsyncOperation* operation = &userLibSettings.async.operations[slot];
+    uint32_t next = operation->next;
+
+    operation->retVal = retVal;
+    operation->usStatus = usStatus;
+    operation->state = uS_AsyncState_Completed;
+    operation->next = ASYNC_SLOT_NONE;
+
+    if (next != ASYNC_SLOT_NONE)
+    {
+        SysStatus nextRetVal;
+
+        userLibSettings.async.operations[next].state = uS_AsyncState_Pending;
+        nextRetVal = asyncSend(next);
+        if (nextRetVal != SysStatus_Success)
+        {
+            asyncComplete(next, nextRetVal, usTinyAESOp_Success);
+        }
+    }
+}
+
+/*
+ * Processes the received response of an asynchronous operation; sends the
+ * next message or completes the operation.
+ * Must be called in the critical section.
+ */
+static void asyncProcess(uint32_t slot)
+{
+    uS_AsyncOperation* operation = &userLibSettings.async.operations[slot];
+    SysStatus retVal;
+
+    /* Rejected; resend the message later instead of blocking the caller */
+    if (IS_RETRYABLE(operation->head.header.status) &&
+        operation->attempts < CFG_US_TINYAES_BACKOFF_MAX_ATTEMPTS)
+    {
+        operation->retryAt = Sys_GetTimeInMs() + getBackoffDelay(operation->attempts, getRetryAfter(&operation->waiter));
+        operation->attempts++;
+        operation->state = uS_AsyncState_Backoff;
+        return;
+    }
+
+    if (operation->head.header.status != usTinyAESOp_Success ||
+        operation->waiter.responseLen != AES_PACKAGE_ENC_DEC_SIZE(operation->chunkLen) ||
+        operation->head.length != operation->chunkLen)
+    {
+        asyncComplete(slot, SysStatus_Success, operation->head.header.status != usTinyAESOp_Success ?
+                                                (usTinyAESStatus)operation->head.header.status : usTinyAESOp_InvalidOperation);
+        return;
+    }
+
+    operation->offset += operation->chunkLen;
+    operation->attempts = 0;
+
+    if (operation->offset < operation->length)
+    {
+        retVal = asyncSend(slot);
+        if (retVal != SysStatus_Success)
+        {
+            asyncComplete(slot, retVal, usTinyAESOp_Success);
+        }
+    }
+    else
+    {
+        asyncComplete(slot, SysStatus_Success, usTinyAESOp_Success);
+    }
+}
+
+/*
+ * Advances the asynchronous operations with received responses or with their
+ * backoff elapsed, and calls the callbacks of the completed ones. Operations
+ * with a callback are released before the callback is called.
+ */
+static void asyncProgress(void)
+{
+    uS_AsyncOperation* operation;
+    uint64_t now = Sys_GetTimeInMs();
+    SysStatus retVal;
+    uint32_t slot;
+
+    Sys_EnterCriticalSection();
+    {
+        for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_ASYNC; slot++)
+        {
+            operation = &userLibSettings.async.operations[slot];
+
+            if (operation->state == uS_AsyncState_Pending && operation->waiter.received)
+            {
+                asyncProcess(slot);
+            }
+            else if (operation->state == uS_AsyncState_Backoff && now >= operation->retryAt)
+            {
+                operation->state = uS_AsyncState_Pending;
+                retVal = asyncSend(slot);
+                if (retVal != SysStatus_Success)
+                {
+                    asyncComplete(slot, retVal, usTinyAESOp_Success);
+                }
+            }
+        }
+    }
+    Sys_ExitCriticalSection();
+
+    /* Callbacks are called out of the critical section, they may block */
+    for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_ASYNC; slot++)
+    {
+        usTinyAESCallback callback = NULL;
+        void* callbackArg = NULL;
+        usTinyAESTicket ticket = US_TINYAES_TICKET_NONE;
+        SysStatus retVal = SysStatus_Success;
+        usTinyAESStatus usStatus = usTinyAESOp_Success;
+
+        operation = &userLibSettings.async.operations[slot];
+
+        Sys_EnterCriticalSection();
+        {
+            if (operation->state == uS_AsyncState_Completed && operation->callback != NULL)
+            {
+                callback = operation->callback;
+                callbackArg = operation->callbackArg;
+                ticket = ASYNC_TICKET(slot, operation->generation);
+                retVal = operation->retVal;
+                usStatus = operation->usStatus;
+
+                operation->state = uS_AsyncState_Free;
+            }
+        }
+        Sys_ExitCriticalSection();
+
+        if (callback != NULL)
+        {
+            callback(ticket, retVal, usStatus, callbackArg);
+        }
+    }
+}
+
+/*
+ * Gets a not released asynchronous operation by its ticket
+ */
+static uS_AsyncOperation* getAsyncOperation(usTinyAESTicket ticket)
+{
+    uint32_t slot = ASYNC_TICKET_SLOT(ticket);
+    uS_AsyncOperation* operation;
+
+    if (slot >= CFG_US_TINYAES_MAX_NUM_OF_ASYNC)
+    {
+        return NULL;
+    }
+
+    operation = &userLibSettings.async.operations[slot];
+    if (operation->state == uS_AsyncState_Free || operation->generation != ASYNC_TICKET_GENERATION(ticket))
+    {
+        return NULL;
+    }
+
+    return operation;
+}
+
+/*
+ * Gets the last outstanding asynchronous operation on a session, if any.
+ * Must be called in the critical section.
+ */
+static uS_AsyncOperation* getLastAsyncOperation(uint32_t sessionID)
+{
+    uS_AsyncOperation* operation;
+    uint32_t slot;
+
+    for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_ASYNC; slot++)
+    {
+        operation = &userLibSettings.async.operations[slot];
+
+        if ((operation->state == uS_AsyncState_Queued || operation->state == uS_AsyncState_Pending ||
+             operation->state == uS_AsyncState_Backoff) &&
+            operation->sessionID == sessionID && operation->next == ASYNC_SLOT_NONE)
+        {
+            return operation;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Submits an asynchronous Encryption/Decryption
+ */
+static SysStatus asyncSubmit(bool enc, uint32_t sessionID,
+                             uint8_t* input, uint32_t inputLen,
+                             uint8_t* output, uint32_t outputLen,
+                             usTinyAESCallback callback, void* callbackArg,
+                             usTinyAESTicket* ticket)
+{
+    SysStatus retVal = SysStatus_NoSlotAvailable;
+    uS_AsyncOperation* operation;
+    uS_AsyncOperation* previous;
+    uint32_t slot;
+
+    *ticket = US_TINYAES_TICKET_NONE;
+
+    if (outputLen < inputLen)
+    {
+        return SysStatus_InvalidSize;
+    }
+
+    Sys_EnterCriticalSection();
+
+    for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_ASYNC; slot++)
+    {
+        operation = &userLibSettings.async.operations[slot];
+
+        if (operation->state != uS_AsyncState_Free)
+        {
+            continue;
+        }
+
+        previous = getLastAsyncOperation(sessionID);
+
+        {
+            operation->encrypt = enc;
+            operation->generation = (uint16_t)AES_HANDLE_NEXT_GENERATION(operation->generation);
+            operation->sessionID = sessionID;
+            operation->input = input;
+            operation->output = output;
+            operation->length = inputLen;
+            operation->offset = 0;
+            operation->attempts = 0;
+            operation->next = ASYNC_SLOT_NONE;
+            operation->callback = callback;
+            operation->callbackArg = callbackArg;
+        }
+
+        /* Operations on the same session are chained so their messages are not interleaved */
+        if (previous != NULL)
+        {
+            previous->next = (uint8_t)slot;
+            operation->state = uS_AsyncState_Queued;
+            retVal = SysStatus_Success;
+        }
+        else
+        {
+            retVal = asyncSend(slot);
+            operation->state = retVal == SysStatus_Success ? uS_AsyncState_Pending : uS_AsyncState_Free;
+        }
+
+        if (retVal == SysStatus_Success)
+        {
+            *ticket = ASYNC_TICKET(slot, operation->generation);
+        }
+
+        break;
+    }
+
+    Sys_ExitCriticalSection();
+
+    return retVal;
+}
+
+/***************************** PUBLIC FUNCTIONS *******************************/
+#define INITIALISE_FUNCTIONEXPAND(a, b, c) a##b##c
+#define INITIALISE_FUNCTION(name) INITIALISE_FUNCTIONEXPAND(us_, name, _Initialise)
+
+SysStatus INITIALISE_FUNCTION(USERVICE_NAME_NONSTR)(void)
+{
+    SysStatus retVal;
+
+    /* Get the Microservice Index to interact with the Microservice */
+    retVal = uService_Initialise(usName, &userLibSettings.execIndex);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    /* Get the IPC Destination ID for the direct messaging */
+    retVal = Sys_GetExecutionIndexByName(usName, &userLibSettings.serviceID);
+    if (retVal == SysStatus_NotSupported)
+    {
+        /* The platform cannot resolve names (e.g. the simulator), the
+         * microservice handle is then the destination of the messages */
+        userLibSettings.serviceID = userLibSettings.execIndex;
+        retVal = SysStatus_Success;
+    }
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_OpenSession(usTinyAESAlg algorithm,
+                                        uint8_t* key, uint32_t keyLen,
+                                        uint8_t* iv, uint32_t ivLen,
+                                        uint32_t timeoutInMs,
+                                        uint32_t* sessionID,
+                                        usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    *sessionID = AES_SESSION_ID_NOT_ACTIVE;
+
+    {
+        request.header.operation = usTinyAESOp_OpenSession;
+        request.header.length = AES_PACKAGE_OPENSESSION_SIZE;
+        request.payload.openSession.alg = algorithm;
+        request.payload.openSession.keyLen = keyLen;
+        request.payload.openSession.ivLen = ivLen;
+
+        /* In case of any memory violation, ZAYA would catch */
+        memcpy(request.payload.openSession.key, key, keyLen);
+        memcpy(request.payload.openSession.iv, iv, ivLen);
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
+    {
+        *sessionID = response.payload.openSession.sessionID;
+    }
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_CloseSession(uint32_t sessionID, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    {
+        request.header.operation = usTinyAESOp_CloseSession;
+        request.header.length = AES_PACKAGE_CLOSESESSION_SIZE;
+        request.payload.closeSession.sessionID = sessionID;
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_Encrypt(uint32_t sessionID, uint8_t* plainData, uint32_t plainDataLen, uint8_t* cipherData, uint32_t cipherDataLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    return encdec(true, sessionID, NULL, 0, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+}
+
+SysStatus us_tinyAES_Decrypt(uint32_t sessionID, uint8_t* cipherData, uint32_t cipherDataLen, uint8_t* plainData, uint32_t plainDataLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    return encdec(false, sessionID, NULL, 0, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
+}
+
+SysStatus us_tinyAES_SetIV(uint32_t sessionID, uint8_t* iv, uint32_t ivLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    if (ivLen > MAX_IV_SIZE)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
+
+    {
+        request.header.operation = usTinyAESOp_SetIV;
+        request.header.length = AES_PACKAGE_SETIV_SIZE;
+        request.payload.setIV.sessionID = sessionID;
+        request.payload.setIV.ivLen = ivLen;
+        memcpy(request.payload.setIV.iv, iv, ivLen);
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_EncryptWithIV(uint32_t sessionID,
+                                   uint8_t* iv, uint32_t ivLen,
+                                   uint8_t* plainData, uint32_t plainDataLen,
+                                   uint8_t* cipherData, uint32_t cipherDataLen,
+                                   uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    if (iv == NULL)
     {
-        uint32_t initialised        : 1;
-    } flags;
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
 
-    /*
-     * The "Execution Index" is a system wide enumaration by the Microservice Runtime
-     * to interact with the Microservice.
-     */
-    uint32_t execIndex;
-} uS_UserLibSettings;
+    return encdec(true, sessionID, iv, ivLen, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+}
 
-/**************************** FUNCTION PROTOTYPES *****************************/
+SysStatus us_tinyAES_DecryptWithIV(uint32_t sessionID,
+                                   uint8_t* iv, uint32_t ivLen,
+                                   uint8_t* cipherData, uint32_t cipherDataLen,
+                                   uint8_t* plainData, uint32_t plainDataLen,
+                                   uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    if (iv == NULL)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
 
-/******************************** VARIABLES ***********************************/
-PRIVATE uS_UserLibSettings userLibSettings;
+    return encdec(false, sessionID, iv, ivLen, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
+}
 
-PRIVATE const char usName[SYS_EXEC_NAME_MAX_LENGTH] = USERVICE_NAME;
+SysStatus us_tinyAES_EncryptOneShot(usTinyAESAlg algorithm,
+                                    uint8_t* key, uint32_t keyLen,
+                                    uint8_t* iv, uint32_t ivLen,
+                                    uint8_t* plainData, uint32_t plainDataLen,
+                                    uint8_t* cipherData, uint32_t cipherDataLen,
+                                    uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    return oneShot(true, AES_KEY_HANDLE_NONE, algorithm, key, keyLen, iv, ivLen, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+}
 
-/***************************** PRIVATE FUNCTIONS *******************************/
+SysStatus us_tinyAES_DecryptOneShot(usTinyAESAlg algorithm,
+                                    uint8_t* key, uint32_t keyLen,
+                                    uint8_t* iv, uint32_t ivLen,
+                                    uint8_t* cipherData, uint32_t cipherDataLen,
+                                    uint8_t* plainData, uint32_t plainDataLen,
+                                    uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    return oneShot(false, AES_KEY_HANDLE_NONE, algorithm, key, keyLen, iv, ivLen, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
+}
 
-static SysStatus encdec(bool enc, uint32_t sessionID, uint8_t* input, uint32_t inputLen, uint8_t* output, uint32_t outputLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+SysStatus us_tinyAES_ImportKey(usTinyAESAlg algorithm,
+                               uint8_t* key, uint32_t keyLen,
+                               uint32_t timeoutInMs,
+                               uint32_t* keyHandle,
+                               usTinyAESStatus* usStatus)
 {
     SysStatus retVal;
     usTinyAESRequestPackage request;
     usTinyAESResponsePackage response;
 
+    *keyHandle = AES_KEY_HANDLE_NONE;
+
+    if (keyLen > MAX_KEY_SIZE)
     {
-        request.header.operation = enc ? usTinyAESOp_Encrypt : usTinyAESOp_Decrypt;
-        request.header.length = AES_PACKAGE_ENC_DEC_SIZE;
-        request.payload.encDec.sessionID = sessionID;
-        request.payload.encDec.length = inputLen;
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
 
-        memcpy(request.payload.encDec.buffer, input, inputLen);
+    {
+        request.header.operation = usTinyAESOp_ImportKey;
+        request.header.length = AES_PACKAGE_IMPORTKEY_SIZE;
+        request.payload.importKey.alg = algorithm;
+        request.payload.importKey.keyLen = keyLen;
+        memcpy(request.payload.importKey.key, key, keyLen);
     }
 
-    retVal = uService_RequestBlocker(userLibSettings.execIndex, (uServicePackage*)&request, (uServicePackage*)&response, timeoutInMs);
+    retVal = sendRequest(&request, &response, timeoutInMs);
     *usStatus = response.header.status;
 
+    /* Do not leave the key on the stack */
+    memset(&request.payload.importKey, 0, sizeof(request.payload.importKey));
+
     if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
     {
-        memcpy(output, response.payload.encDec.buffer, response.payload.encDec.length);
+        *keyHandle = response.payload.importKey.keyHandle;
     }
 
-    return SysStatus_Success;
+    return retVal;
 }
 
-/***************************** PUBLIC FUNCTIONS *******************************/
-#define INITIALISE_FUNCTIONEXPAND(a, b, c) a##b##c
-#define INITIALISE_FUNCTION(name) INITIALISE_FUNCTIONEXPAND(us_, name, _Initialise)
+SysStatus us_tinyAES_ReleaseKey(uint32_t keyHandle, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
 
-SysStatus INITIALISE_FUNCTION(USERVICE_NAME_NONSTR)(void)
+    {
+        request.header.operation = usTinyAESOp_ReleaseKey;
+        request.header.length = AES_PACKAGE_RELEASEKEY_SIZE;
+        request.payload.releaseKey.keyHandle = keyHandle;
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_StoreKey(usTinyAESAlg algorithm,
+                              uint8_t* key, uint32_t keyLen,
+                              uint32_t timeoutInMs,
+                              uint32_t* keyID,
+                              usTinyAESStatus* usStatus)
 {
-    /* Get the Microservice Index to interact with the Microservice */
-    return uService_Initialise(usName, &userLibSettings.execIndex);
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    *keyID = AES_KEY_HANDLE_NONE;
+
+    if (keyLen > MAX_KEY_SIZE)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
+
+    {
+        request.header.operation = usTinyAESOp_StoreKey;
+        request.header.length = AES_PACKAGE_IMPORTKEY_SIZE;
+        request.payload.importKey.alg = algorithm;
+        request.payload.importKey.keyLen = keyLen;
+        memcpy(request.payload.importKey.key, key, keyLen);
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    /* Do not leave the key on the stack */
+    memset(&request.payload.importKey, 0, sizeof(request.payload.importKey));
+
+    if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
+    {
+        *keyID = response.payload.importKey.keyHandle;
+    }
+
+    return retVal;
 }
 
-SysStatus us_tinyAES_OpenSession(usTinyAESAlg algorithm,
-                                        uint8_t* key, uint32_t keyLen,
+SysStatus us_tinyAES_DeleteKey(uint32_t keyID, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    {
+        request.header.operation = usTinyAESOp_DeleteKey;
+        request.header.length = AES_PACKAGE_RELEASEKEY_SIZE;
+        request.payload.releaseKey.keyHandle = keyID;
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_DeriveKey(uint32_t parentKeyHandle,
+                               uint8_t* label, uint32_t labelLen,
+                               uint8_t* context, uint32_t contextLen,
+                               uint32_t timeoutInMs,
+                               uint32_t* keyHandle,
+                               usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    *keyHandle = AES_KEY_HANDLE_NONE;
+
+    if (labelLen > US_TINYAES_DERIVE_MAX_LABEL_SIZE || contextLen > US_TINYAES_DERIVE_MAX_CONTEXT_SIZE)
+    {
+        *usStatus = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+        return SysStatus_InvalidParameter;
+    }
+
+    {
+        request.header.operation = usTinyAESOp_DeriveKey;
+        request.header.length = AES_PACKAGE_DERIVEKEY_SIZE;
+        request.payload.deriveKey.parentKeyHandle = parentKeyHandle;
+        request.payload.deriveKey.labelLen = labelLen;
+        request.payload.deriveKey.contextLen = contextLen;
+        memcpy(request.payload.deriveKey.label, label, labelLen);
+        memcpy(request.payload.deriveKey.context, context, contextLen);
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
+    {
+        *keyHandle = response.payload.importKey.keyHandle;
+    }
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_OpenSessionWithKey(uint32_t keyHandle,
                                         uint8_t* iv, uint32_t ivLen,
                                         uint32_t timeoutInMs,
                                         uint32_t* sessionID,
@@ -88,19 +1536,21 @@ SysStatus us_tinyAES_OpenSession(usTinyAESAlg algorithm,
 
     *sessionID = AES_SESSION_ID_NOT_ACTIVE;
 
+    if (ivLen > MAX_IV_SIZE)
     {
-        request.header.operation = usTinyAESOp_OpenSession;
-        request.header.length = AES_PACKAGE_OPENSESSION_SIZE;
-        request.payload.openSession.alg = algorithm;
-        request.payload.openSession.keyLen = keyLen;
-        request.payload.openSession.ivLen = ivLen;
+        *usStatus = usTinyAESOp_InvalidParam_Key;
+        return SysStatus_InvalidParameter;
+    }
 
-        /* In case of any memory violation, ZAYA would catch */
-        memcpy(request.payload.openSession.key, key, keyLen);
-        memcpy(request.payload.openSession.iv, iv, ivLen);
+    {
+        request.header.operation = usTinyAESOp_OpenSessionWithKey;
+        request.header.length = AES_PACKAGE_OPENSESSION_WITHKEY_SIZE;
+        request.payload.openSessionWithKey.keyHandle = keyHandle;
+        request.payload.openSessionWithKey.ivLen = ivLen;
+        memcpy(request.payload.openSessionWithKey.iv, iv, ivLen);
     }
 
-    retVal = uService_RequestBlocker(userLibSettings.execIndex, (uServicePackage*)&request, (uServicePackage*)&response, timeoutInMs);
+    retVal = sendRequest(&request, &response, timeoutInMs);
     *usStatus = response.header.status;
 
     if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
@@ -111,30 +1561,408 @@ SysStatus us_tinyAES_OpenSession(usTinyAESAlg algorithm,
     return retVal;
 }
 
-SysStatus us_tinyAES_CloseSession(uint32_t sessionID, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+SysStatus us_tinyAES_EncryptOneShotWithKey(uint32_t keyHandle,
+                                           uint8_t* iv, uint32_t ivLen,
+                                           uint8_t* plainData, uint32_t plainDataLen,
+                                           uint8_t* cipherData, uint32_t cipherDataLen,
+                                           uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    if (keyHandle == AES_KEY_HANDLE_NONE)
+    {
+        *usStatus = usTinyAESOp_InvalidKey;
+        return SysStatus_InvalidParameter;
+    }
+
+    return oneShot(true, keyHandle, usTinyAESAlg_None, NULL, 0, iv, ivLen, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+}
+
+SysStatus us_tinyAES_DecryptOneShotWithKey(uint32_t keyHandle,
+                                           uint8_t* iv, uint32_t ivLen,
+                                           uint8_t* cipherData, uint32_t cipherDataLen,
+                                           uint8_t* plainData, uint32_t plainDataLen,
+                                           uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    if (keyHandle == AES_KEY_HANDLE_NONE)
+    {
+        *usStatus = usTinyAESOp_InvalidKey;
+        return SysStatus_InvalidParameter;
+    }
+
+    return oneShot(false, keyHandle, usTinyAESAlg_None, NULL, 0, iv, ivLen, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
+}
+
+SysStatus us_tinyAES_Batch(usTinyAESBatchItem* items, uint32_t itemCount, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
 {
     SysStatus retVal;
     usTinyAESRequestPackage request;
     usTinyAESResponsePackage response;
+    uint32_t offset = 0;
+    uint32_t i;
+
+    *usStatus = usTinyAESOp_Success;
 
+    /* Build the items */
+    for (i = 0; i < itemCount; i++)
     {
-        request.header.operation = usTinyAESOp_CloseSession;
-        request.header.length = AES_PACKAGE_CLOSESESSION_SIZE;
-        request.payload.closeSession.sessionID = sessionID;
+        usTinyAESBatchItemHead* itemHead;
+        uint8_t* itemPayload;
+        uint32_t itemLen;
+
+        switch (items[i].operation)
+        {
+            case usTinyAESOp_OpenSession:
+                itemLen = sizeof(usTinyAESPayloadOpenSession);
+                break;
+            case usTinyAESOp_OpenSessionWithKey:
+                itemLen = sizeof(usTinyAESPayloadOpenSessionWithKey);
+                break;
+            case usTinyAESOp_CloseSession:
+                itemLen = sizeof(usTinyAESPayloadCloseSession);
+                break;
+            case usTinyAESOp_Encrypt:
+            case usTinyAESOp_Decrypt:
+                if (items[i].outputLen < items[i].inputLen)
+                {
+                    *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+                    return SysStatus_InvalidSize;
+                }
+                if (items[i].iv != NULL && items[i].ivLen != MAX_IV_SIZE)
+                {
+                    *usStatus = usTinyAESOp_InvalidParam_Key;
+                    return SysStatus_InvalidParameter;
+                }
+                itemLen = AES_ENC_DEC_FIXED_SIZE + (items[i].iv != NULL ? MAX_IV_SIZE : 0) + items[i].inputLen;
+                break;
+            default:
+                *usStatus = usTinyAESOp_InvalidOperation;
+                return SysStatus_InvalidParameter;
+        }
+
+        if (itemLen % sizeof(uint32_t) != 0 ||
+            AES_BATCH_ITEM_HEAD_SIZE + itemLen > AES_BATCH_MAX_ITEMS_LEN - offset)
+        {
+            *usStatus = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+            return SysStatus_InvalidSize;
+        }
+
+        itemHead = (usTinyAESBatchItemHead*)&request.payload.batch.items[offset];
+        itemPayload = &request.payload.batch.items[offset + AES_BATCH_ITEM_HEAD_SIZE];
+
+        itemHead->operation = (uint16_t)items[i].operation;
+        itemHead->length = (uint16_t)itemLen;
+
+        switch (items[i].operation)
+        {
+            case usTinyAESOp_OpenSession:
+                {
+                    usTinyAESPayloadOpenSession* openSession = (usTinyAESPayloadOpenSession*)itemPayload;
+
+                    if (items[i].keyLen > MAX_KEY_SIZE || items[i].ivLen > MAX_IV_SIZE)
+                    {
+                        *usStatus = usTinyAESOp_InvalidParam_Key;
+                        return SysStatus_InvalidParameter;
+                    }
+
+                    openSession->alg = items[i].algorithm;
+                    openSession->keyLen = items[i].keyLen;
+                    openSession->ivLen = items[i].ivLen;
+                    memcpy(openSession->key, items[i].key, items[i].keyLen);
+                    memcpy(openSession->iv, items[i].iv, items[i].ivLen);
+                }
+                break;
+            case usTinyAESOp_OpenSessionWithKey:
+                {
+                    usTinyAESPayloadOpenSessionWithKey* openSession = (usTinyAESPayloadOpenSessionWithKey*)itemPayload;
+
+                    if (items[i].ivLen > MAX_IV_SIZE)
+                    {
+                        *usStatus = usTinyAESOp_InvalidParam_Key;
+                        return SysStatus_InvalidParameter;
+                    }
+
+                    openSession->keyHandle = items[i].keyHandle;
+                    openSession->ivLen = items[i].ivLen;
+                    memcpy(openSession->iv, items[i].iv, items[i].ivLen);
+                }
+                break;
+            case usTinyAESOp_CloseSession:
+                ((usTinyAESPayloadCloseSession*)itemPayload)->sessionID = items[i].sessionID;
+                break;
+            default:
+                {
+                    usTinyAESPayloadEncDec* encDec = (usTinyAESPayloadEncDec*)itemPayload;
+
+                    encDec->sessionID = items[i].sessionID;
+                    encDec->length = (uint16_t)items[i].inputLen;
+                    encDec->flags = 0;
+
+                    if (items[i].iv != NULL)
+                    {
+                        encDec->flags = AES_ENC_DEC_FLAG_IV;
+                        memcpy(encDec->buffer, items[i].iv, MAX_IV_SIZE);
+                    }
+
+                    memcpy(&encDec->buffer[(encDec->flags & AES_ENC_DEC_FLAG_IV) ? MAX_IV_SIZE : 0], items[i].input, items[i].inputLen);
+                }
+                break;
+        }
+
+        offset += AES_BATCH_ITEM_HEAD_SIZE + itemLen;
+    }
+
+    request.header.operation = usTinyAESOp_Batch;
+    request.header.length = AES_PACKAGE_HEAD_SIZE + AES_BATCH_FIXED_SIZE + offset;
+    request.payload.batch.count = itemCount;
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
     }
 
-    retVal = uService_RequestBlocker(userLibSettings.execIndex, (uServicePackage*)&request, (uServicePackage*)&response, timeoutInMs);
     *usStatus = response.header.status;
+    if (response.header.status != usTinyAESOp_Success)
+    {
+        return retVal;
+    }
+
+    /* Collect the results; only the received part of the response is parsed */
+    {
+        uint32_t resultsLen = response.header.length - AES_PACKAGE_HEAD_SIZE - AES_BATCH_FIXED_SIZE;
+
+        if (response.header.length < AES_PACKAGE_HEAD_SIZE + AES_BATCH_FIXED_SIZE)
+        {
+            *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+            return retVal;
+        }
+
+        offset = 0;
+        for (i = 0; i < itemCount; i++)
+        {
+            usTinyAESBatchResultHead* result = (usTinyAESBatchResultHead*)&response.payload.batch.items[offset];
+
+            if (resultsLen - offset < AES_BATCH_RESULT_HEAD_SIZE ||
+                resultsLen - offset - AES_BATCH_RESULT_HEAD_SIZE < result->length)
+            {
+                *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+                return retVal;
+            }
+
+            offset += AES_BATCH_RESULT_HEAD_SIZE + result->length;
+        }
+    }
+
+    offset = 0;
+    for (i = 0; i < itemCount; i++)
+    {
+        usTinyAESBatchResultHead* result = (usTinyAESBatchResultHead*)&response.payload.batch.items[offset];
+        uint8_t* output = &response.payload.batch.items[offset + AES_BATCH_RESULT_HEAD_SIZE];
+
+        items[i].status = (usTinyAESStatus)result->status;
+
+        if (result->status == usTinyAESOp_Success)
+        {
+            if (items[i].operation == usTinyAESOp_OpenSession ||
+                items[i].operation == usTinyAESOp_OpenSessionWithKey)
+            {
+                memcpy(&items[i].sessionID, output, sizeof(items[i].sessionID));
+            }
+            else if (items[i].operation == usTinyAESOp_Encrypt || items[i].operation == usTinyAESOp_Decrypt)
+            {
+                memcpy(items[i].output, output, result->length);
+            }
+        }
+
+        offset += AES_BATCH_RESULT_HEAD_SIZE + result->length;
+    }
 
     return retVal;
 }
 
-SysStatus us_tinyAES_Encrypt(uint32_t sessionID, uint8_t* plainData, uint32_t plainDataLen, uint8_t* cipherData, uint32_t cipherDataLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+SysStatus us_tinyAES_RegisterRegion(uint8_t* region, uint32_t regionLen)
 {
-    return encdec(true, sessionID, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+    if (region != NULL && regionLen <= US_TINYAES_REGION_HEADROOM)
+    {
+        return SysStatus_InvalidSize;
+    }
+
+    userLibSettings.region.buffer = region;
+    userLibSettings.region.length = region != NULL ? regionLen : 0;
+
+    return SysStatus_Success;
 }
 
-SysStatus us_tinyAES_Decrypt(uint32_t sessionID, uint8_t* cipherData, uint32_t cipherDataLen, uint8_t* plainData, uint32_t plainDataLen, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+SysStatus us_tinyAES_EncryptRegion(uint32_t sessionID, uint32_t offset, uint32_t length, uint32_t timeoutInMs,
+                                   uint32_t* processedLen, usTinyAESStatus* usStatus)
+{
+    return encdecRegion(true, sessionID, offset, length, timeoutInMs, processedLen, usStatus);
+}
+
+SysStatus us_tinyAES_DecryptRegion(uint32_t sessionID, uint32_t offset, uint32_t length, uint32_t timeoutInMs,
+                                   uint32_t* processedLen, usTinyAESStatus* usStatus)
+{
+    return encdecRegion(false, sessionID, offset, length, timeoutInMs, processedLen, usStatus);
+}
+
+SysStatus us_tinyAES_EncryptAsync(uint32_t sessionID,
+                                  uint8_t* plainData, uint32_t plainDataLen,
+                                  uint8_t* cipherData, uint32_t cipherDataLen,
+                                  usTinyAESCallback callback, void* callbackArg,
+                                  usTinyAESTicket* ticket)
+{
+    return asyncSubmit(true, sessionID, plainData, plainDataLen, cipherData, cipherDataLen, callback, callbackArg, ticket);
+}
+
+SysStatus us_tinyAES_DecryptAsync(uint32_t sessionID,
+                                  uint8_t* cipherData, uint32_t cipherDataLen,
+                                  uint8_t* plainData, uint32_t plainDataLen,
+                                  usTinyAESCallback callback, void* callbackArg,
+                                  usTinyAESTicket* ticket)
+{
+    return asyncSubmit(false, sessionID, cipherData, cipherDataLen, plainData, plainDataLen, callback, callbackArg, ticket);
+}
+
+SysStatus us_tinyAES_Poll(usTinyAESTicket ticket, bool* completed, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal = SysStatus_Success;
+    uS_AsyncOperation* operation;
+
+    *completed = false;
+    *usStatus = usTinyAESOp_Success;
+
+    dispatchResponses();
+    asyncProgress();
+
+    if (ticket == US_TINYAES_TICKET_NONE)
+    {
+        return SysStatus_Success;
+    }
+
+    Sys_EnterCriticalSection();
+    {
+        operation = getAsyncOperation(ticket);
+
+        if (operation == NULL)
+        {
+            retVal = SysStatus_InvalidParameter;
+        }
+        else if (operation->state == uS_AsyncState_Completed)
+        {
+            *completed = true;
+            *usStatus = operation->usStatus;
+            retVal = operation->retVal;
+
+            operation->state = uS_AsyncState_Free;
+        }
+    }
+    Sys_ExitCriticalSection();
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_Wait(usTinyAESTicket ticket, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    bool completed;
+    uint64_t timeout = Sys_GetTimeInMs() + timeoutInMs;
+
+    while (true)
+    {
+        retVal = us_tinyAES_Poll(ticket, &completed, usStatus);
+        if (completed || retVal != SysStatus_Success)
+        {
+            return retVal;
+        }
+
+        if (Sys_GetTimeInMs() > timeout)
+        {
+            return SysStatus_Timeout;
+        }
+
+        (void)Sys_Sleep(CFG_US_TINYAES_POLL_PERIOD_MS);
+    }
+}
+
+SysStatus us_tinyAES_SetSessionPriority(uint32_t sessionID, usTinyAESPriority priority, uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    if (priority > usTinyAESPriority_Bulk)
+    {
+        *usStatus = usTinyAESOp_InvalidOperation;
+        return SysStatus_InvalidParameter;
+    }
+
+    {
+        request.header.operation = usTinyAESOp_SetSessionPriority;
+        request.header.length = AES_PACKAGE_SET_SESSION_PRIORITY_SIZE;
+        request.payload.setSessionPriority.sessionID = sessionID;
+        request.payload.setSessionPriority.priority = (uint32_t)priority;
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_OpenSessionTicket(usTinyAESAlg algorithm,
+                                       uint8_t* key, uint32_t keyLen,
+                                       uint8_t* iv, uint32_t ivLen,
+                                       uint32_t timeoutInMs,
+                                       usTinyAESSessionTicket* ticket,
+                                       usTinyAESStatus* usStatus)
+{
+    SysStatus retVal;
+    usTinyAESRequestPackage request;
+    usTinyAESResponsePackage response;
+
+    {
+        request.header.operation = usTinyAESOp_OpenSessionTicket;
+        request.header.length = AES_PACKAGE_OPENSESSION_SIZE;
+        request.payload.openSession.alg = algorithm;
+        request.payload.openSession.keyLen = keyLen;
+        request.payload.openSession.ivLen = ivLen;
+
+        /* In case of any memory violation, ZAYA would catch */
+        memcpy(request.payload.openSession.key, key, keyLen);
+        memcpy(request.payload.openSession.iv, iv, ivLen);
+    }
+
+    retVal = sendRequest(&request, &response, timeoutInMs);
+    *usStatus = response.header.status;
+
+    /* Do not leave the raw key on the stack */
+    memset(&request.payload.openSession, 0, sizeof(request.payload.openSession));
+
+    if (retVal == SysStatus_Success && response.header.status == usTinyAESOp_Success)
+    {
+        if (response.header.length != AES_RESPONSE_TICKET_SIZE)
+        {
+            *usStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+            return retVal;
+        }
+
+        memcpy(ticket->data, response.payload.openSessionTicket.ticket, US_TINYAES_SESSION_TICKET_SIZE);
+    }
+
+    return retVal;
+}
+
+SysStatus us_tinyAES_EncryptWithSessionTicket(usTinyAESSessionTicket* ticket,
+                                              uint8_t* plainData, uint32_t plainDataLen,
+                                              uint8_t* cipherData, uint32_t cipherDataLen,
+                                              uint32_t timeoutInMs, usTinyAESStatus* usStatus)
+{
+    return ticketEncDec(true, ticket, plainData, plainDataLen, cipherData, cipherDataLen, timeoutInMs, usStatus);
+}
+
+SysStatus us_tinyAES_DecryptWithSessionTicket(usTinyAESSessionTicket* ticket,
+                                              uint8_t* cipherData, uint32_t cipherDataLen,
+                                              uint8_t* plainData, uint32_t plainDataLen,
+                                              uint32_t timeoutInMs, usTinyAESStatus* usStatus)
 {
-    return encdec(false, sessionID, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
+    return ticketEncDec(false, ticket, cipherData, cipherDataLen, plainData, plainDataLen, timeoutInMs, usStatus);
 }
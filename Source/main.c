@@ -15,244 +15,4094 @@
 
 /***************************** MACRO DEFINITIONS ******************************/
 
+/*
+ * Free lists are shared by the workers; the session/key state itself is not,
+ * as the requests on a session and the key requests of an owner are processed
+ * by one worker at a time. See dispatchJob().
+ */
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    #define AES_ENTER_CRITICAL_SECTION()        Sys_EnterCriticalSection()
+    #define AES_EXIT_CRITICAL_SECTION()         Sys_ExitCriticalSection()
+#else
+    #define AES_ENTER_CRITICAL_SECTION()
+    #define AES_EXIT_CRITICAL_SECTION()
+#endif
+
 /***************************** TYPE DEFINITIONS *******************************/
 
-/**************************** FUNCTION PROTOTYPES *****************************/
+/* A sealed session is carried as is in a session ticket */
+typedef char uS_SealedSessionSizeCheck[(sizeof(AESSealedSession) == US_TINYAES_SESSION_TICKET_SIZE) ? 1 : -1];
+
+/* The owner name of a stored key is sealed in place of the IV */
+typedef char uS_StoredKeyOwnerCheck[(SYS_EXEC_NAME_MAX_LENGTH <= AES_BLOCKLEN) ? 1 : -1];
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+/* Priority lanes of the worker queues; a lower lane is served first */
+typedef enum
+{
+    AESLane_Control = 0,
+    AESLane_Express,
+    AESLane_Interactive,
+    AESLane_Bulk,
+
+    AESLane_Count
+} AESLane;
+
+/* Jobs of a requester queued to a worker */
+typedef struct AESFlow
+{
+    struct AESFlow* next;
+
+    /* Queued jobs in arrival order */
+    AESJob* head;
+    AESJob* tail;
+
+    uint8_t senderID;
+
+    /* Request bytes the flow may still be served in this round */
+    uint32_t deficit;
+} AESFlow;
+
+typedef struct
+{
+    /* Flows with queued jobs; served by Deficit Round Robin from the head */
+    AESFlow* head;
+    AESFlow* tail;
+} AESFlowQueue;
+
+typedef struct
+{
+    AESFlowQueue lanes[AESLane_Count];
+
+    /* Released once per dispatched job */
+    uint32_t semaphoreID;
+
+    uint32_t threadID;
+
+    uint64_t stack[CFG_US_TINYAES_WORKER_STACK_SIZE / sizeof(uint64_t)];
+} AESWorker;
+#endif
+
+/**************************** FUNCTION PROTOTYPES *****************************/
+
+PRIVATE void startAESService(void);
+
+/******************************** VARIABLES ***********************************/
+
+/* Session Table; free slots are kept in a stack for O(1) allocation */
+PRIVATE struct
+{
+    AESSession slots[CFG_US_TINYAES_MAX_NUM_OF_SESSION];
+
+    uint8_t freeSlots[CFG_US_TINYAES_MAX_NUM_OF_SESSION];
+    uint32_t freeSlotCount;
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    /* Sessions in the storage; see spillSession() */
+    AESSpilledSession spilled[CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION];
+#endif
+
+#if CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS > 0
+    /* Set by the kernel when it is time to sweep the idle sessions */
+    TimerFlag idleTimerFlag;
+#endif
+} sessionTable;
+
+#if AES_USE_DEVICE_KEYS
+/* Keys to seal the state kept out of the RAM; see initialiseDeviceKeys() */
+PRIVATE struct
+{
+    /* Keys of the current boot; the sealed state is not valid after a restart */
+    AESSealingKeys boot;
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    /* Keys of the Key Store; same across restarts */
+    AESSealingKeys storage;
+#endif
+
+#if CFG_US_TINYAES_DEVICE_KEY
+    /* Expanded once for the callers; see US_TINYAES_DEVICE_KEY_HANDLE */
+    struct AES_ctx client;
+#endif
+
+    /* Counter block of the sealing; see sealSession() */
+    uint32_t bootCount;
+    uint32_t sequence;
+} deviceKeys;
+#endif
+
+/* Key Table; same allocation scheme with the Session Table */
+PRIVATE struct
+{
+    AESKey slots[CFG_US_TINYAES_MAX_NUM_OF_KEY];
+
+    uint8_t freeSlots[CFG_US_TINYAES_MAX_NUM_OF_KEY];
+    uint32_t freeSlotCount;
+} keyTable;
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+/* Key Store; index of the keys in the storage and the cache of their schedules */
+PRIVATE struct
+{
+    AESStoredKey keys[CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY];
+
+    /* Number of uses of each key; persisted to warm up the cache at startup */
+    uint32_t uses[CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY];
+    bool usesChanged;
+    uint64_t usesSaved;
+
+    /* Generation of each place; persisted, so a deleted ID never comes back */
+    uint16_t generations[CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY];
+
+    AESCachedKey cache[CFG_US_TINYAES_KEY_STORE_CACHE_SIZE];
+} keyStore;
+#endif
+
+/* Request Buffer Pool; carved from static RAM, free buffers are kept in a list */
+PRIVATE struct
+{
+    AESJob jobs[CFG_US_TINYAES_NUM_OF_JOBS];
+
+    AESJob* freeList;
+
+    /* Payload bytes of the admitted jobs; see admitJob() */
+    uint32_t admittedBytes;
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    /* The dispatcher waits on it while the pool is empty or a dispatch conflicts */
+    bool dispatcherWaiting;
+    uint32_t semaphoreID;
+#endif
+} jobPool;
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+PRIVATE AESWorker workers[CFG_US_TINYAES_NUM_OF_WORKERS];
+
+/* Flow Pool; a flow has at least one queued job, so there are never more flows than jobs */
+PRIVATE struct
+{
+    AESFlow flows[CFG_US_TINYAES_NUM_OF_JOBS];
+
+    AESFlow* freeList;
+} flowPool;
+
+/* Worker and lane of the jobs in flight on a session slot; see dispatchJob() */
+PRIVATE struct
+{
+    uint32_t pending;
+    uint8_t worker;
+    uint8_t lane;
+} sessionOrder[CFG_US_TINYAES_MAX_NUM_OF_SESSION];
+#elif CFG_US_TINYAES_SLICE_BLOCKS > 0
+/* Jobs processed in slices, and the jobs queued behind them; see runSlice() */
+PRIVATE struct
+{
+    AESJob* head;
+    AESJob* tail;
+
+    uint32_t lastSequence;
+} sliceQueue;
+#endif
+
+#if CFG_US_TINYAES_RATE_LIMIT
+/* Rate Limiting state of the callers; see getClient() */
+PRIVATE AESClient clientTable[CFG_US_TINYAES_MAX_NUM_OF_CLIENTS];
+#endif
+
+/**************************** PRIVATE FUNCTIONS ******************************/
+
+/*
+ * Receives (the rest of) the current message partially
+ */
+PRIVATE ALWAYS_INLINE void receiveMessage(uint8_t* buffer, uint32_t len)
+{
+    uint8_t senderID;
+    uint32_t sequenceNo;
+    (void)senderID;
+    (void)sequenceNo;
+
+    if (len > 0)
+    {
+        (void)Sys_ReceiveMessage(&senderID, buffer, len, &sequenceNo);
+    }
+}
+
+/*
+ * Drops the unprocessed part of the current message, so it is not confused
+ * with the next message
+ */
+PRIVATE void discardMessage(uint32_t len)
+{
+    uint8_t chunk[CFG_US_TINYAES_RECEIVE_CHUNK_LEN];
+    uint32_t chunkLen;
+
+    while (len > 0)
+    {
+        chunkLen = len < sizeof(chunk) ? len : sizeof(chunk);
+        receiveMessage(chunk, chunkLen);
+        len -= chunkLen;
+    }
+}
+
+/*
+ * Reads the next part of the job payload into the buffer.
+ *
+ * Normally, the payload is received from the message box while the request
+ * is processed. If the whole message is already received into the job (with
+ * workers or for sliced processing), the part is moved in place; the buffer
+ * never runs ahead of the read offset, so a part is never overwritten before
+ * read.
+ */
+PRIVATE ALWAYS_INLINE void receivePayload(AESJob* job, uint8_t* buffer, uint32_t len)
+{
+    uint8_t* part = (uint8_t*)&job->package + job->readOffset;
+
+    if (!job->buffered)
+    {
+        receiveMessage(buffer, len);
+    }
+    else if (buffer != part)
+    {
+        memmove(buffer, part, len);
+    }
+
+    job->readOffset += len;
+}
+
+/*
+ * Skips the next part of the job payload
+ */
+PRIVATE ALWAYS_INLINE void discardPayload(AESJob* job, uint32_t len)
+{
+    if (!job->buffered)
+    {
+        discardMessage(len);
+    }
+
+    job->readOffset += len;
+}
+
+/*
+ * Sends a header only response; used for errors and for the operations
+ * without an output. The request tag is echoed back.
+ */
+PRIVATE ALWAYS_INLINE void sendError(uint8_t receiverID, uServicePackageHeader* request, uint8_t status)
+{
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+    uServicePackageHeader response =
+    {
+        .operation = request->operation,
+        .status = status,
+        .length = USERVICE_PACKAGE_HEADER_SIZE,
+        ._reserved = request->_reserved
+    };
+
+    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, USERVICE_PACKAGE_HEADER_SIZE, &sequenceNo);
+}
+
+/*
+ * Checks whether the deadline of a request is passed
+ */
+PRIVATE ALWAYS_INLINE bool isExpired(usTinyAESRequestPackage* request)
+{
+    return AES_DEADLINE_PASSED(request->deadline, (uint32_t)Sys_GetTimeInMs());
+}
+
+/*
+ * Sets the deadline a queued job is ordered by; a job without a deadline is
+ * aged, see CFG_US_TINYAES_NO_DEADLINE_AGING_MS
+ */
+PRIVATE ALWAYS_INLINE void setOrderDeadline(AESJob* job)
+{
+    job->orderDeadline = job->package.deadline;
+    if (job->orderDeadline == AES_DEADLINE_NONE)
+    {
+        job->orderDeadline = (uint32_t)Sys_GetTimeInMs() + CFG_US_TINYAES_NO_DEADLINE_AGING_MS;
+        if (job->orderDeadline == AES_DEADLINE_NONE)
+        {
+            job->orderDeadline++;
+        }
+    }
+}
+
+/*
+ * Sends a successful response with a Session/Key Handle
+ */
+PRIVATE ALWAYS_INLINE void sendHandle(uint8_t receiverID, uServicePackageHeader* request, uint32_t handle)
+{
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+    struct
+    {
+        uServicePackageHeader header;
+        uint32_t deadline;
+        uint32_t handle;
+    } response =
+    {
+        .header.operation = request->operation,
+        .header.status = usTinyAESOp_Success,
+        .header.length = AES_RESPONSE_HANDLE_SIZE,
+        .header._reserved = request->_reserved,
+        .deadline = AES_DEADLINE_NONE,
+        .handle = handle
+    };
+
+    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, AES_RESPONSE_HANDLE_SIZE, &sequenceNo);
+}
+
+#if AES_USE_CMAC
+/*
+ * Doubles a block in GF(2^128) to get the CMAC subkeys; in and out may overlap
+ */
+PRIVATE void doubleBlock(uint8_t* out, const uint8_t* in)
+{
+    uint8_t carry = 0;
+    uint8_t msb;
+    int32_t i;
+
+    for (i = AES_BLOCKLEN - 1; i >= 0; i--)
+    {
+        msb = (uint8_t)(in[i] >> 7);
+        out[i] = (uint8_t)((in[i] << 1) | carry);
+        carry = msb;
+    }
+
+    if (carry)
+    {
+        out[AES_BLOCKLEN - 1] ^= 0x87;
+    }
+}
+
+/*
+ * Computes the subkeys of a CMAC key whose context is already expanded
+ */
+PRIVATE void initialiseCMACSubkeys(AESCMAC* cmac)
+{
+    uint8_t l[AES_BLOCKLEN] = {0};
+
+    AES_ECB_encrypt(&cmac->ctx, l);
+    doubleBlock(cmac->k1, l);
+    doubleBlock(cmac->k2, cmac->k1);
+
+    memset(l, 0, sizeof(l));
+}
+
+#if AES_USE_DEVICE_KEYS
+PRIVATE void initialiseCMAC(AESCMAC* cmac, const uint8_t* key)
+{
+    AES_init_ctx(&cmac->ctx, key);
+
+    initialiseCMACSubkeys(cmac);
+}
+#endif
+
+PRIVATE ALWAYS_INLINE void startCMAC(AESCMACState* state)
+{
+    memset(state, 0, sizeof(AESCMACState));
+}
+
+PRIVATE void updateCMAC(AESCMAC* cmac, AESCMACState* state, const uint8_t* data, uint32_t len)
+{
+    uint32_t chunkLen;
+    uint32_t i;
+
+    while (len > 0)
+    {
+        /* A full block is processed only when more data follows */
+        if (state->blockLen == AES_BLOCKLEN)
+        {
+            for (i = 0; i < AES_BLOCKLEN; i++)
+            {
+                state->mac[i] ^= state->block[i];
+            }
+            AES_ECB_encrypt(&cmac->ctx, state->mac);
+            state->blockLen = 0;
+        }
+
+        chunkLen = AES_BLOCKLEN - state->blockLen;
+        chunkLen = len < chunkLen ? len : chunkLen;
+
+        memcpy(&state->block[state->blockLen], data, chunkLen);
+        state->blockLen += chunkLen;
+        data += chunkLen;
+        len -= chunkLen;
+    }
+}
+
+PRIVATE void finishCMAC(AESCMAC* cmac, AESCMACState* state, uint8_t* tag)
+{
+    const uint8_t* subkey = cmac->k1;
+    uint32_t i;
+
+    /* An incomplete (or empty) last block is padded */
+    if (state->blockLen < AES_BLOCKLEN)
+    {
+        state->block[state->blockLen] = 0x80;
+        memset(&state->block[state->blockLen + 1], 0, AES_BLOCKLEN - state->blockLen - 1);
+        subkey = cmac->k2;
+    }
+
+    for (i = 0; i < AES_BLOCKLEN; i++)
+    {
+        state->mac[i] ^= state->block[i] ^ subkey[i];
+    }
+    AES_ECB_encrypt(&cmac->ctx, state->mac);
+
+    memcpy(tag, state->mac, AES_BLOCKLEN);
+    memset(state, 0, sizeof(AESCMACState));
+}
+
+/*
+ * Derives a key with the SP 800-108 KDF in counter mode with AES-CMAC;
+ * K(i) = CMAC(KDK, [i]8 || Label || 0x00 || Context || [L]16)
+ *
+ * @param kdk Key derivation key
+ * @param label Label; purpose of the derived key
+ * @param context Context; may be NULL if contextLen is 0
+ * @param[out] key AES_KEYLEN bytes derived key
+ */
+PRIVATE void deriveKey(AESCMAC* kdk,
+                       const uint8_t* label, uint32_t labelLen,
+                       const uint8_t* context, uint32_t contextLen,
+                       uint8_t* key)
+{
+    const uint8_t separator = 0x00;
+    const uint8_t keyBits[2] = { (uint8_t)((AES_KEYLEN * 8) >> 8), (uint8_t)(AES_KEYLEN * 8) };
+    AESCMACState state;
+    uint8_t counter;
+
+    for (counter = 1; counter <= AES_KEYLEN / AES_BLOCKLEN; counter++)
+    {
+        startCMAC(&state);
+        updateCMAC(kdk, &state, &counter, sizeof(counter));
+        updateCMAC(kdk, &state, label, labelLen);
+        updateCMAC(kdk, &state, &separator, sizeof(separator));
+        updateCMAC(kdk, &state, context, contextLen);
+        updateCMAC(kdk, &state, keyBits, sizeof(keyBits));
+        finishCMAC(kdk, &state, &key[(counter - 1) * AES_BLOCKLEN]);
+    }
+}
+#endif
+
+#if AES_USE_DEVICE_KEYS
+/*
+ * Reads the device secret and increments the boot counter
+ */
+PRIVATE SysStatus readDeviceStorage(AESDeviceStorage* device)
+{
+    uint8_t diff = 0;
+    SysStatus retVal;
+    uint32_t i;
+
+    retVal = Sys_StorageRead(CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET, sizeof(AESDeviceStorage), (uint8_t*)device);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    /* An erased storage is not a secret */
+    for (i = 1; i < AES_KEYLEN; i++)
+    {
+        diff |= (uint8_t)(device->secret[i] ^ device->secret[0]);
+    }
+
+    if (diff == 0)
+    {
+        LOG_ERROR("Device Secret is not provisioned!");
+        return SysStatus_NotInitialised;
+    }
+
+    /* Persisted before use, so a boot count is never used twice */
+    device->bootCount++;
+
+    return Sys_StorageWrite(CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET + AES_KEYLEN,
+                            sizeof(device->bootCount), (uint8_t*)&device->bootCount);
+}
+
+/*
+ * End of the storage regions in use; see the Storage Layout
+ */
+PRIVATE uint32_t getStorageEnd(void)
+{
+    uint32_t end = CFG_US_TINYAES_DEVICE_SECRET_STORAGE_OFFSET + AES_DEVICE_STORAGE_SIZE;
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    if (end < CFG_US_TINYAES_SPILL_STORAGE_OFFSET + AES_SPILL_STORAGE_SIZE)
+    {
+        end = CFG_US_TINYAES_SPILL_STORAGE_OFFSET + AES_SPILL_STORAGE_SIZE;
+    }
+#endif
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    if (end < CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET + AES_KEY_STORE_STORAGE_SIZE)
+    {
+        end = CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET + AES_KEY_STORE_STORAGE_SIZE;
+    }
+#endif
+
+    return end;
+}
+
+/*
+ * Derives the device keys from the device secret with the Device UID as the
+ * context. The sealing keys are derived for the current boot, so the sealed
+ * sessions do not outlive a restart; only the Key Store keys are kept.
+ */
+PRIVATE SysStatus initialiseDeviceKeys(void)
+{
+    static const uint8_t rootLabel[] = "TINYAES-ROOT";
+    static const uint8_t encryptionLabel[] = "TINYAES-SEAL-ENC";
+    static const uint8_t authenticationLabel[] = "TINYAES-SEAL-MAC";
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    static const uint8_t storageEncryptionLabel[] = "TINYAES-STORE-ENC";
+    static const uint8_t storageAuthenticationLabel[] = "TINYAES-STORE-MAC";
+#endif
+#if CFG_US_TINYAES_DEVICE_KEY
+    static const uint8_t clientLabel[] = "TINYAES-DEVICE-KEY";
+#endif
+    uint32_t uid[AES_KEYLEN / sizeof(uint32_t)] = {0};
+    uint32_t uidLength = 0;
+    AESDeviceStorage device;
+    uint8_t key[AES_KEYLEN];
+    AESCMAC kdk;
+    SysStatus retVal;
+
+    retVal = Sys_GetDeviceUID(uid, &uidLength);
+    if (retVal == SysStatus_Success)
+    {
+        retVal = readDeviceStorage(&device);
+    }
+
+    if (retVal != SysStatus_Success)
+    {
+        memset(&device, 0, sizeof(device));
+        return retVal;
+    }
+
+    initialiseCMAC(&kdk, device.secret);
+    deriveKey(&kdk, rootLabel, sizeof(rootLabel) - 1, (uint8_t*)uid, sizeof(uid), key);
+    initialiseCMAC(&kdk, key);
+
+    deriveKey(&kdk, encryptionLabel, sizeof(encryptionLabel) - 1,
+              (uint8_t*)&device.bootCount, sizeof(device.bootCount), key);
+    AES_init_ctx(&deviceKeys.boot.encryption, key);
+
+    deriveKey(&kdk, authenticationLabel, sizeof(authenticationLabel) - 1,
+              (uint8_t*)&device.bootCount, sizeof(device.bootCount), key);
+    initialiseCMAC(&deviceKeys.boot.authentication, key);
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    deriveKey(&kdk, storageEncryptionLabel, sizeof(storageEncryptionLabel) - 1, NULL, 0, key);
+    AES_init_ctx(&deviceKeys.storage.encryption, key);
+
+    deriveKey(&kdk, storageAuthenticationLabel, sizeof(storageAuthenticationLabel) - 1, NULL, 0, key);
+    initialiseCMAC(&deviceKeys.storage.authentication, key);
+#endif
+
+#if CFG_US_TINYAES_DEVICE_KEY
+    deriveKey(&kdk, clientLabel, sizeof(clientLabel) - 1, NULL, 0, key);
+    AES_init_ctx(&deviceKeys.client, key);
+#endif
+
+    deviceKeys.bootCount = device.bootCount;
+    deviceKeys.sequence = 0;
+
+    memset(key, 0, sizeof(key));
+    memset(&kdk, 0, sizeof(kdk));
+    memset(&device, 0, sizeof(device));
+
+    return SysStatus_Success;
+}
+
+#if AES_USE_SEALING
+PRIVATE void computeCMAC(AESCMAC* cmac, const uint8_t* data, uint32_t len, uint8_t* tag)
+{
+    AESCMACState state;
+
+    startCMAC(&state);
+    updateCMAC(cmac, &state, data, len);
+    finishCMAC(cmac, &state, tag);
+}
+
+/*
+ * Compares tags in constant time
+ */
+PRIVATE bool isEqualTag(const uint8_t* tag1, const uint8_t* tag2)
+{
+    uint8_t diff = 0;
+    uint32_t i;
+
+    for (i = 0; i < AES_BLOCKLEN; i++)
+    {
+        diff |= (uint8_t)(tag1[i] ^ tag2[i]);
+    }
+
+    return diff == 0;
+}
+
+/*
+ * Encrypts/Decrypts the key and IV of a sealed session in place
+ */
+PRIVATE void cryptSealedSession(AESSealingKeys* keys, AESSealedSession* sealed)
+{
+    uint8_t counter[AES_BLOCKLEN] = {0};
+
+    memcpy(counter, &sealed->id, sizeof(sealed->id));
+    memcpy(&counter[4], &sealed->bootCount, sizeof(sealed->bootCount));
+    memcpy(&counter[8], &sealed->sequence, sizeof(sealed->sequence));
+
+    AES_ctx_set_iv(&keys->encryption, counter);
+    AES_CTR_xcrypt_buffer(&keys->encryption, sealed->key, AES_KEYLEN + AES_BLOCKLEN);
+}
+
+/*
+ * Seals the state of a session; the key and the current IV
+ *
+ * @param keys Boot or Key Store sealing keys
+ * @param id Session Handle or owner ID; see AESSealedSession
+ */
+PRIVATE void sealSession(AESSealingKeys* keys, uint32_t id, usTinyAESAlg alg, uint32_t blockSize, struct AES_ctx* ctx, AESSealedSession* sealed)
+{
+    AES_ENTER_CRITICAL_SECTION();
+    sealed->sequence = ++deviceKeys.sequence;
+    AES_EXIT_CRITICAL_SECTION();
+
+    sealed->id = id;
+    sealed->bootCount = deviceKeys.bootCount;
+    sealed->alg = alg;
+    sealed->blockSize = blockSize;
+    memcpy(sealed->key, ctx->RoundKey, AES_KEYLEN);
+    memcpy(sealed->iv, ctx->Iv, AES_BLOCKLEN);
+
+    AES_ENTER_CRITICAL_SECTION();
+    cryptSealedSession(keys, sealed);
+    computeCMAC(&keys->authentication, (uint8_t*)sealed, AES_SEALED_SESSION_AUTH_SIZE, sealed->tag);
+    AES_EXIT_CRITICAL_SECTION();
+}
+
+/*
+ * Verifies a sealed session and decrypts it in place
+ *
+ * @return false if the sealed session is modified
+ */
+PRIVATE bool unsealSession(AESSealingKeys* keys, AESSealedSession* sealed)
+{
+    uint8_t tag[AES_BLOCKLEN];
+    bool valid;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    computeCMAC(&keys->authentication, (uint8_t*)sealed, AES_SEALED_SESSION_AUTH_SIZE, tag);
+
+    valid = isEqualTag(tag, sealed->tag);
+    if (valid)
+    {
+        cryptSealedSession(keys, sealed);
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return valid;
+}
+#endif
+#endif
+
+#if AES_USE_CMAC
+/*
+ * Known answer tests of the primitives the device keys, the sealing and the
+ * Key Derivation are built on; run once at startup, before any key is used.
+ * AES-CMAC vectors are from SP 800-38B (AES-256, Examples 10 and 11); the
+ * others are computed with an independent implementation.
+ */
+PRIVATE SysStatus runSelfTests(void)
+{
+    static const uint8_t cmacKey[AES_KEYLEN] =
+    {
+        0x60, 0x3D, 0xEB, 0x10, 0x15, 0xCA, 0x71, 0xBE, 0x2B, 0x73, 0xAE, 0xF0, 0x85, 0x7D, 0x77, 0x81,
+        0x1F, 0x35, 0x2C, 0x07, 0x3B, 0x61, 0x08, 0xD7, 0x2D, 0x98, 0x10, 0xA3, 0x09, 0x14, 0xDF, 0xF4
+    };
+    static const uint8_t cmacMessage[40] =
+    {
+        0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+        0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+        0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11
+    };
+    static const uint8_t cmacTags[2][AES_BLOCKLEN] =
+    {
+        /* First block only; a complete last block */
+        { 0x28, 0xA7, 0x02, 0x3F, 0x45, 0x2E, 0x8F, 0x82, 0xBD, 0x4B, 0xF2, 0x8D, 0x8C, 0x37, 0xC3, 0x5C },
+        /* Whole message; a padded last block */
+        { 0xAA, 0xF3, 0xD8, 0xF1, 0xDE, 0x56, 0x40, 0xC2, 0x32, 0xF5, 0xB1, 0x69, 0xB9, 0xC9, 0x11, 0xE6 }
+    };
+    /* KDF of the key 00..1F with the label "KAT" and the context 00..07 */
+    static const uint8_t kdfLabel[] = "KAT";
+    static const uint8_t kdfContext[8] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 };
+    static const uint8_t kdfKey[AES_KEYLEN] =
+    {
+        0x75, 0x04, 0x0D, 0x7A, 0xFB, 0xCA, 0x83, 0x9C, 0x18, 0x0F, 0xDF, 0xCF, 0xBA, 0xD8, 0xAD, 0x19,
+        0xC6, 0x65, 0x0D, 0x21, 0x1C, 0x25, 0x14, 0x2F, 0x9B, 0x38, 0x00, 0x42, 0x8E, 0xF1, 0x44, 0xDA
+    };
+#if AES_USE_SEALING
+    /*
+     * Tag of the session 0x01020304 with the key 40..5F and the IV 60..6F,
+     * sealed at the boot 5 as the sequence 6 with the encryption key 00..1F
+     * and the authentication key 20..3F
+     */
+    static const uint8_t sealedTag[AES_BLOCKLEN] =
+    {
+        0xC7, 0xA4, 0xE5, 0x82, 0x99, 0xB5, 0x83, 0x7F, 0x45, 0x33, 0xA4, 0xE3, 0xE0, 0x87, 0x47, 0x07
+    };
+    AESSealingKeys sealingKeys;
+    AESSealedSession sealed;
+#endif
+    uint8_t key[AES_KEYLEN];
+    uint8_t tag[AES_BLOCKLEN];
+    AESCMACState state;
+    AESCMAC cmac;
+    bool passed;
+    uint32_t i;
+
+    AES_init_ctx(&cmac.ctx, cmacKey);
+    initialiseCMACSubkeys(&cmac);
+
+    startCMAC(&state);
+    updateCMAC(&cmac, &state, cmacMessage, AES_BLOCKLEN);
+    finishCMAC(&cmac, &state, tag);
+    passed = memcmp(tag, cmacTags[0], AES_BLOCKLEN) == 0;
+
+    startCMAC(&state);
+    updateCMAC(&cmac, &state, cmacMessage, sizeof(cmacMessage));
+    finishCMAC(&cmac, &state, tag);
+    passed = passed && memcmp(tag, cmacTags[1], AES_BLOCKLEN) == 0;
+
+    for (i = 0; i < AES_KEYLEN; i++)
+    {
+        key[i] = (uint8_t)i;
+    }
+
+    AES_init_ctx(&cmac.ctx, key);
+    initialiseCMACSubkeys(&cmac);
+    deriveKey(&cmac, kdfLabel, sizeof(kdfLabel) - 1, kdfContext, sizeof(kdfContext), key);
+    passed = passed && memcmp(key, kdfKey, AES_KEYLEN) == 0;
+
+#if AES_USE_SEALING
+    for (i = 0; i < AES_KEYLEN; i++)
+    {
+        key[i] = (uint8_t)i;
+    }
+    AES_init_ctx(&sealingKeys.encryption, key);
+
+    for (i = 0; i < AES_KEYLEN; i++)
+    {
+        key[i] = (uint8_t)(AES_KEYLEN + i);
+    }
+    AES_init_ctx(&sealingKeys.authentication.ctx, key);
+    initialiseCMACSubkeys(&sealingKeys.authentication);
+
+    sealed.id = 0x01020304;
+    sealed.bootCount = 5;
+    sealed.sequence = 6;
+    sealed.alg = usTinyAESAlg_AES_CBC_256;
+    sealed.blockSize = AES_BLOCKLEN;
+    for (i = 0; i < AES_KEYLEN; i++)
+    {
+        sealed.key[i] = (uint8_t)(0x40 + i);
+    }
+    for (i = 0; i < AES_BLOCKLEN; i++)
+    {
+        sealed.iv[i] = (uint8_t)(0x40 + AES_KEYLEN + i);
+    }
+
+    cryptSealedSession(&sealingKeys, &sealed);
+    computeCMAC(&sealingKeys.authentication, (uint8_t*)&sealed, AES_SEALED_SESSION_AUTH_SIZE, sealed.tag);
+    passed = passed && memcmp(sealed.tag, sealedTag, AES_BLOCKLEN) == 0;
+
+    /* A modified record is rejected, the original one is restored */
+    sealed.iv[0] ^= 0x01;
+    passed = passed && !unsealSession(&sealingKeys, &sealed);
+    sealed.iv[0] ^= 0x01;
+    passed = passed && unsealSession(&sealingKeys, &sealed) && sealed.key[0] == 0x40 && sealed.iv[AES_BLOCKLEN - 1] == 0x6F;
+
+    memset(&sealingKeys, 0, sizeof(sealingKeys));
+    memset(&sealed, 0, sizeof(sealed));
+#endif
+
+    memset(&cmac, 0, sizeof(cmac));
+    memset(key, 0, sizeof(key));
+
+    return passed ? SysStatus_Success : SysStatus_Fail;
+}
+#endif
+
+PRIVATE void initialiseSessionTable(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SESSION; i++)
+    {
+        sessionTable.slots[i].id = AES_SESSION_ID_NOT_ACTIVE;
+        sessionTable.slots[i].generation = 1;
+
+        /* Pop order starts from the first slot */
+        sessionTable.freeSlots[i] = (uint8_t)(CFG_US_TINYAES_MAX_NUM_OF_SESSION - 1 - i);
+    }
+
+    sessionTable.freeSlotCount = CFG_US_TINYAES_MAX_NUM_OF_SESSION;
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION; i++)
+    {
+        sessionTable.spilled[i].id = AES_SESSION_ID_NOT_ACTIVE;
+    }
+#endif
+}
+
+PRIVATE void releaseSession(AESSession* session);
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+#define AES_SPILL_STORAGE_OFFSET(_index) \
+            (CFG_US_TINYAES_SPILL_STORAGE_OFFSET + (_index) * (uint32_t)sizeof(AESSealedSession))
+
+/*
+ * Writes a session to the storage before its slot is released. A free place
+ * is used if any; otherwise the least recently used spilled session is closed
+ * for the place. The caller is in the critical section.
+ *
+ * @return false if the session cannot be written; it must be kept in RAM
+ */
+PRIVATE bool spillSession(AESSession* session)
+{
+    AESSpilledSession* entry = &sessionTable.spilled[0];
+    AESSealedSession sealed;
+    SysStatus retVal;
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION; i++)
+    {
+        if (sessionTable.spilled[i].id == AES_SESSION_ID_NOT_ACTIVE)
+        {
+            entry = &sessionTable.spilled[i];
+            break;
+        }
+
+        if (sessionTable.spilled[i].lastUsed < entry->lastUsed)
+        {
+            entry = &sessionTable.spilled[i];
+        }
+    }
+
+    sealSession(&deviceKeys.boot, session->id, session->alg, session->blockSize, &session->ctx, &sealed);
+
+    retVal = Sys_StorageWrite(AES_SPILL_STORAGE_OFFSET(entry - sessionTable.spilled), sizeof(sealed), (uint8_t*)&sealed);
+    if (retVal != SysStatus_Success)
+    {
+        /* A partly written record is detected when its session is restored */
+        LOG_WARNING("Session 0x%x cannot be spilled! %d", session->id, retVal);
+        return false;
+    }
+
+    if (entry->id != AES_SESSION_ID_NOT_ACTIVE)
+    {
+        LOG_INFO("Spilled Session 0x%x Evicted", entry->id);
+    }
+
+    entry->id = session->id;
+    entry->sequence = sealed.sequence;
+    entry->priority = session->priority;
+    entry->lastUsed = session->lastUsed;
+
+    return true;
+}
+
+/*
+ * Drops a spilled session; its record is left in the storage but not
+ * accepted anymore. The caller is in the critical section.
+ *
+ * @return false if the session is not spilled
+ */
+PRIVATE bool dropSpilledSession(uint32_t sessionID)
+{
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION; i++)
+    {
+        if (sessionTable.spilled[i].id == sessionID)
+        {
+            sessionTable.spilled[i].id = AES_SESSION_ID_NOT_ACTIVE;
+            return true;
+        }
+    }
+
+    return false;
+}
+#endif
+
+#if CFG_US_TINYAES_SESSION_EVICT_IDLE_MS > 0
+/*
+ * Gets the least recently used session if it has been idle long enough to
+ * be evicted; the caller is in the critical section and the table is full
+ */
+PRIVATE AESSession* getEvictableSession(uint64_t now)
+{
+    AESSession* lru = &sessionTable.slots[0];
+    uint32_t i;
+
+    for (i = 1; i < CFG_US_TINYAES_MAX_NUM_OF_SESSION; i++)
+    {
+        if (sessionTable.slots[i].lastUsed < lru->lastUsed)
+        {
+            lru = &sessionTable.slots[i];
+        }
+    }
+
+    return (now - lru->lastUsed >= CFG_US_TINYAES_SESSION_EVICT_IDLE_MS) ? lru : NULL;
+}
+
+/*
+ * Evicts a session to free its slot; it is spilled to the storage if enabled,
+ * closed otherwise
+ *
+ * @return false if the session cannot be spilled; it is not evicted then
+ */
+PRIVATE bool evictSession(AESSession* session)
+{
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    if (!spillSession(session))
+    {
+        return false;
+    }
+#else
+    LOG_INFO("Session 0x%x Evicted", session->id);
+#endif
+
+    releaseSession(session);
+
+    return true;
+}
+#endif
+
+PRIVATE ALWAYS_INLINE AESSession* allocateSession(uint8_t receiverID)
+{
+    AESSession* session = NULL;
+    uint64_t now = Sys_GetTimeInMs();
+    uint32_t slot;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+#if CFG_US_TINYAES_SESSION_EVICT_IDLE_MS > 0
+    if (sessionTable.freeSlotCount == 0)
+    {
+        session = getEvictableSession(now);
+        if (session != NULL)
+        {
+            (void)evictSession(session);
+            session = NULL;
+        }
+    }
+#endif
+
+    if (sessionTable.freeSlotCount > 0)
+    {
+        slot = sessionTable.freeSlots[--sessionTable.freeSlotCount];
+        session = &sessionTable.slots[slot];
+
+        session->id = AES_HANDLE_MAKE(session->generation, slot, receiverID);
+        session->priority = usTinyAESPriority_Default;
+        session->lastUsed = now;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return session;
+}
+
+PRIVATE void releaseSession(AESSession* session)
+{
+    /* Not the slot in the handle; a restored session may be in any slot */
+    uint32_t slot = (uint32_t)(session - sessionTable.slots);
+
+    /* Do not leave the key schedule behind */
+    memset(&session->ctx, 0, sizeof(session->ctx));
+
+    session->id = AES_SESSION_ID_NOT_ACTIVE;
+
+    /* Invalidate all the handles issued for this slot so far */
+    session->generation = AES_HANDLE_NEXT_GENERATION(session->generation);
+
+    AES_ENTER_CRITICAL_SECTION();
+    sessionTable.freeSlots[sessionTable.freeSlotCount++] = (uint8_t)slot;
+    AES_EXIT_CRITICAL_SECTION();
+}
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+/*
+ * Finds a session which is not in the slot of its handle; a session restored
+ * from the storage is put into any free slot. A spilled session is restored,
+ * evicting another session if the table is full. The caller is in the
+ * critical section.
+ *
+ * @param sessionID Session Handle
+ * @param[in,out] session Session if it is found; left as is otherwise
+ *
+ * @retval usTinyAESOp_Success Found, or not found at all
+ * @retval usTinyAESOp_Busy Spilled but no session can be evicted for it now
+ */
+PRIVATE usTinyAESStatus findSession(uint32_t sessionID, AESSession** session)
+{
+    AESSpilledSession* entry = NULL;
+    AESSealedSession sealed;
+    AESSession* restored;
+    uint8_t priority;
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SESSION; i++)
+    {
+        if (sessionTable.slots[i].id == sessionID)
+        {
+            *session = &sessionTable.slots[i];
+            return usTinyAESOp_Success;
+        }
+    }
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION && entry == NULL; i++)
+    {
+        if (sessionTable.spilled[i].id == sessionID)
+        {
+            entry = &sessionTable.spilled[i];
+        }
+    }
+
+    if (entry == NULL)
+    {
+        return usTinyAESOp_Success;
+    }
+
+    if (Sys_StorageRead(AES_SPILL_STORAGE_OFFSET(entry - sessionTable.spilled), sizeof(sealed), (uint8_t*)&sealed) != SysStatus_Success ||
+        sealed.id != entry->id || sealed.sequence != entry->sequence ||
+        !unsealSession(&deviceKeys.boot, &sealed))
+    {
+        LOG_WARNING("Spilled Session 0x%x cannot be restored", sessionID);
+        entry->id = AES_SESSION_ID_NOT_ACTIVE;
+        return usTinyAESOp_Success;
+    }
+
+    restored = NULL;
+    if (sessionTable.freeSlotCount == 0)
+    {
+        restored = getEvictableSession(Sys_GetTimeInMs());
+        if (restored == NULL)
+        {
+            memset(&sealed, 0, sizeof(sealed));
+            return usTinyAESOp_Busy;
+        }
+    }
+
+    /* Its place may be used for the evicted session; the record is already read */
+    priority = entry->priority;
+    entry->id = AES_SESSION_ID_NOT_ACTIVE;
+    if (restored != NULL && !evictSession(restored))
+    {
+        /* The record is intact unless the failed write was to its place */
+        entry->id = sessionID;
+        memset(&sealed, 0, sizeof(sealed));
+        return usTinyAESOp_Busy;
+    }
+
+    restored = &sessionTable.slots[sessionTable.freeSlots[--sessionTable.freeSlotCount]];
+
+    restored->id = sessionID;
+    restored->alg = (usTinyAESAlg)sealed.alg;
+    restored->blockSize = sealed.blockSize;
+    restored->priority = priority;
+    AES_init_ctx_iv(&restored->ctx, sealed.key, sealed.iv);
+
+    memset(&sealed, 0, sizeof(sealed));
+
+    *session = restored;
+
+    return usTinyAESOp_Success;
+}
+#endif
+
+#if CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS > 0
+/*
+ * Frees the slots of the sessions idle longer than
+ * CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS and sets the timer for the next
+ * sweep. The sessions are spilled if enabled, closed otherwise; the spilled
+ * sessions are left to the least recently used eviction of spillSession().
+ */
+PRIVATE void reclaimIdleSessions(void)
+{
+    uint64_t now = Sys_GetTimeInMs();
+    AESSession* session;
+    SysStatus retVal;
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SESSION; i++)
+    {
+        session = &sessionTable.slots[i];
+
+        AES_ENTER_CRITICAL_SECTION();
+
+        if (session->id != AES_SESSION_ID_NOT_ACTIVE &&
+            now - session->lastUsed >= CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS)
+        {
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+            /* Kept in RAM if it cannot be written */
+            if (spillSession(session))
+            {
+                releaseSession(session);
+            }
+#else
+            LOG_INFO("Idle Session 0x%x Closed", session->id);
+            releaseSession(session);
+#endif
+        }
+
+        AES_EXIT_CRITICAL_SECTION();
+    }
+
+    sessionTable.idleTimerFlag = false;
+    retVal = Sys_SetTimer(CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS, &sessionTable.idleTimerFlag);
+    if (retVal != SysStatus_Success)
+    {
+        LOG_WARNING("Idle Session Timer cannot be set! %d", retVal);
+    }
+}
+#endif
+
+/*
+ * Validates a session handle in O(1) and returns the session
+ *
+ * @param receiverID Requester ID; must be the owner of the session
+ * @param sessionID Session Handle
+ * @param[out] session Session if the handle is valid
+ *
+ * @retval usTinyAESOp_Success Valid Session
+ * @retval usTinyAESOp_NoSession The slot has no active session
+ * @retval usTinyAESOp_InvalidSession Stale handle or not owned by the requester
+ * @retval usTinyAESOp_Busy Spilled session cannot be restored now; see findSession()
+ */
+PRIVATE ALWAYS_INLINE usTinyAESStatus getSession(uint8_t receiverID, uint32_t sessionID, AESSession** session)
+{
+    uint32_t slot = AES_HANDLE_GET_SLOT(sessionID);
+    usTinyAESStatus status = usTinyAESOp_Success;
+    AESSession* found;
+
+    if (slot >= CFG_US_TINYAES_MAX_NUM_OF_SESSION)
+    {
+        return usTinyAESOp_InvalidSession;
+    }
+
+    /* Validated and marked as used at once; an idle session may be closed meanwhile */
+    AES_ENTER_CRITICAL_SECTION();
+
+    found = &sessionTable.slots[slot];
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    if (found->id != sessionID && AES_HANDLE_GET_OWNER(sessionID) == receiverID)
+    {
+        status = findSession(sessionID, &found);
+    }
+#endif
+
+    if (status != usTinyAESOp_Success)
+    {
+        /* Keep the status */
+    }
+    else if (found->id == AES_SESSION_ID_NOT_ACTIVE)
+    {
+        status = usTinyAESOp_NoSession;
+    }
+    else if (AES_HANDLE_GET_OWNER(sessionID) != receiverID ||
+             found->id != sessionID)
+    {
+        status = usTinyAESOp_InvalidSession;
+    }
+    else
+    {
+        found->lastUsed = Sys_GetTimeInMs();
+        *session = found;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return status;
+}
+
+PRIVATE void initialiseJobPool(void)
+{
+    uint32_t i;
+
+    jobPool.freeList = NULL;
+    for (i = 0; i < CFG_US_TINYAES_NUM_OF_JOBS; i++)
+    {
+        jobPool.jobs[i].next = jobPool.freeList;
+        jobPool.freeList = &jobPool.jobs[i];
+    }
+}
+
+/*
+ * Gets a free job. With workers, waits until a worker releases a job if the
+ * pool is empty, or returns NULL if the Admission Control is enabled; otherwise
+ * the pool is never empty as a job is released before the next message is
+ * received.
+ */
+PRIVATE AESJob* allocateJob(void)
+{
+    AESJob* job;
+
+    while (1)
+    {
+        AES_ENTER_CRITICAL_SECTION();
+
+        job = jobPool.freeList;
+        if (job != NULL)
+        {
+            jobPool.freeList = job->next;
+            job->next = NULL;
+            job->readOffset = AES_PACKAGE_HEAD_SIZE;
+            job->admittedLen = 0;
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+            memset(job->sessionSlots, 0, sizeof(job->sessionSlots));
+#endif
+            job->buffered = false;
+            job->started = false;
+        }
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0 && CFG_US_TINYAES_BUSY_THRESHOLD == 0
+        else
+        {
+            jobPool.dispatcherWaiting = true;
+        }
+#endif
+
+        AES_EXIT_CRITICAL_SECTION();
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0 && CFG_US_TINYAES_BUSY_THRESHOLD == 0
+        if (job == NULL)
+        {
+            (void)Sys_WaitSemaphore(jobPool.semaphoreID);
+            continue;
+        }
+#endif
+
+        return job;
+    }
+}
+
+PRIVATE void releaseJob(AESJob* job)
+{
+    AES_ENTER_CRITICAL_SECTION();
+
+    jobPool.admittedBytes -= job->admittedLen;
+    job->admittedLen = 0;
+
+    job->next = jobPool.freeList;
+    jobPool.freeList = job;
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    {
+        uint32_t slot;
+
+        /* Only the dispatched jobs have marked slots */
+        for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_SESSION; slot++)
+        {
+            if (job->sessionSlots[slot / 8] & (1 << (slot % 8)))
+            {
+                sessionOrder[slot].pending--;
+            }
+        }
+    }
+
+    job->dispatched = false;
+
+    /* Also woken up to retry a dispatch; see dispatchJob() */
+    if (jobPool.dispatcherWaiting)
+    {
+        jobPool.dispatcherWaiting = false;
+        (void)Sys_ReleaseSemaphore(jobPool.semaphoreID);
+    }
+#endif
+
+    AES_EXIT_CRITICAL_SECTION();
+}
+
+#if AES_USE_RETRY
+/*
+ * Rejects a request with usTinyAESOp_Busy or usTinyAESOp_Throttled, and a hint
+ * for the caller to retry not earlier than
+ */
+PRIVATE void sendRetryAfter(uint8_t receiverID, uServicePackageHeader* request, uint8_t status, uint32_t retryAfterMs)
+{
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+    struct
+    {
+        uServicePackageHeader header;
+        uint32_t deadline;
+        uint32_t retryAfterMs;
+    } response =
+    {
+        .header.operation = request->operation,
+        .header.status = status,
+        .header.length = AES_RESPONSE_BUSY_SIZE,
+        .header._reserved = request->_reserved,
+        .deadline = AES_DEADLINE_NONE,
+        .retryAfterMs = retryAfterMs
+    };
+
+    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, AES_RESPONSE_BUSY_SIZE, &sequenceNo);
+}
+#endif
+
+#if AES_USE_ADMISSION
+/*
+ * Admission Control; admits a job unless the payload of the admitted jobs
+ * would exceed CFG_US_TINYAES_BUSY_THRESHOLD. A job is always admitted when
+ * nothing else is, so a single large request is not rejected forever. Without
+ * workers, the jobs queued for sliced processing stay admitted until done.
+ */
+PRIVATE ALWAYS_INLINE bool admitJob(AESJob* job)
+{
+    bool admitted = false;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    if (jobPool.admittedBytes == 0 ||
+        jobPool.admittedBytes + job->payloadLen <= CFG_US_TINYAES_BUSY_THRESHOLD)
+    {
+        jobPool.admittedBytes += job->payloadLen;
+        job->admittedLen = job->payloadLen;
+        admitted = true;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return admitted;
+}
+
+/*
+ * Rejects a request with usTinyAESOp_Busy. The retry-after hint grows with the
+ * admitted work, which is roughly the time to drain it.
+ */
+PRIVATE ALWAYS_INLINE void sendBusy(uint8_t receiverID, uServicePackageHeader* request)
+{
+    sendRetryAfter(receiverID, request, usTinyAESOp_Busy,
+                   CFG_US_TINYAES_BUSY_RETRY_AFTER_MS * (1 + jobPool.admittedBytes / CFG_US_TINYAES_BUSY_THRESHOLD));
+}
+#endif
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+/*
+ * Admits a job unless its requester already holds
+ * CFG_US_TINYAES_MAX_JOBS_PER_SENDER dispatched jobs. The pool is small, so
+ * the held jobs are counted instead of tracked per requester.
+ */
+PRIVATE bool admitSender(AESJob* job)
+{
+    uint32_t held = 0;
+    uint32_t i;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    for (i = 0; i < CFG_US_TINYAES_NUM_OF_JOBS; i++)
+    {
+        if (jobPool.jobs[i].dispatched && jobPool.jobs[i].senderID == job->senderID)
+        {
+            held++;
+        }
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return held < CFG_US_TINYAES_MAX_JOBS_PER_SENDER;
+}
+#endif
+
+#if CFG_US_TINYAES_RATE_LIMIT
+#define AES_RATE_BYTES_CAPACITY(_rate) \
+            (((_rate) * CFG_US_TINYAES_RATE_BURST_MS / 1000) > AES_PACKAGE_MAX_SIZE ? \
+             ((_rate) * CFG_US_TINYAES_RATE_BURST_MS / 1000) : AES_PACKAGE_MAX_SIZE)
+#define AES_RATE_OPS_CAPACITY(_rate) \
+            (((_rate) * CFG_US_TINYAES_RATE_BURST_MS / 1000) > 1 ? ((_rate) * CFG_US_TINYAES_RATE_BURST_MS / 1000) : 1)
+
+/*
+ * Refills a bucket for the elapsed time, and gets the time until it has the
+ * given number of tokens; all in thousandths of a token
+ */
+PRIVATE uint32_t refillBucket(uint64_t* tokens, uint64_t capacity, uint32_t rate, uint64_t elapsed, uint64_t cost)
+{
+    if (rate == 0)
+    {
+        return 0;
+    }
+
+    *tokens += elapsed * rate;
+    if (*tokens > capacity * 1000)
+    {
+        *tokens = capacity * 1000;
+    }
+
+    return *tokens >= cost ? 0 : (uint32_t)((cost - *tokens + rate - 1) / rate);
+}
+
+/*
+ * Gets the Rate Limiting state of a caller. A caller not tracked yet takes a
+ * free entry or the entry of an idle caller whose buckets are full again,
+ * since that state is same with a new caller.
+ */
+PRIVATE AESClient* getClient(uint8_t senderID, uint64_t now)
+{
+    AESClient* client;
+    AESClient* idle = NULL;
+    uint32_t byteRate;
+    uint32_t opRate;
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_CLIENTS; i++)
+    {
+        client = &clientTable[i];
+
+        if (client->used && client->senderID == senderID)
+        {
+            return client;
+        }
+
+        if (idle != NULL)
+        {
+            continue;
+        }
+
+        if (!client->used)
+        {
+            idle = client;
+            continue;
+        }
+
+        byteRate = CFG_US_TINYAES_RATE_BYTES_PER_SEC(client->senderID);
+        opRate = CFG_US_TINYAES_RATE_OPS_PER_SEC(client->senderID);
+        if ((now - client->lastRefill) * byteRate + client->byteTokens >= (uint64_t)AES_RATE_BYTES_CAPACITY(byteRate) * 1000 &&
+            (now - client->lastRefill) * opRate + client->opTokens >= (uint64_t)AES_RATE_OPS_CAPACITY(opRate) * 1000)
+        {
+            idle = client;
+        }
+    }
+
+    if (idle != NULL)
+    {
+        byteRate = CFG_US_TINYAES_RATE_BYTES_PER_SEC(senderID);
+        opRate = CFG_US_TINYAES_RATE_OPS_PER_SEC(senderID);
+
+        idle->used = true;
+        idle->senderID = senderID;
+        idle->lastRefill = now;
+        idle->byteTokens = (uint64_t)AES_RATE_BYTES_CAPACITY(byteRate) * 1000;
+        idle->opTokens = (uint64_t)AES_RATE_OPS_CAPACITY(opRate) * 1000;
+    }
+
+    return idle;
+}
+
+/*
+ * Takes a request from the buckets of its caller
+ *
+ * @return 0 if the request is in the rate, otherwise the time in ms until the
+ *         buckets are refilled enough for it
+ */
+PRIVATE uint32_t limitRate(AESJob* job)
+{
+    uint8_t senderID = job->senderID;
+    uint32_t byteRate = CFG_US_TINYAES_RATE_BYTES_PER_SEC(senderID);
+    uint32_t opRate = CFG_US_TINYAES_RATE_OPS_PER_SEC(senderID);
+    uint64_t now = Sys_GetTimeInMs();
+    uint64_t byteCost = (uint64_t)job->payloadLen * 1000;
+    AESClient* client;
+    uint32_t byteWait;
+    uint32_t opWait;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    client = getClient(senderID, now);
+    if (client == NULL)
+    {
+        AES_EXIT_CRITICAL_SECTION();
+        return 0;
+    }
+
+    byteWait = refillBucket(&client->byteTokens, AES_RATE_BYTES_CAPACITY(byteRate), byteRate, now - client->lastRefill, byteCost);
+    opWait = refillBucket(&client->opTokens, AES_RATE_OPS_CAPACITY(opRate), opRate, now - client->lastRefill, 1000);
+    client->lastRefill = now;
+
+    /* Take from both buckets or neither */
+    if (byteWait == 0 && opWait == 0)
+    {
+        client->byteTokens -= byteRate != 0 ? byteCost : 0;
+        client->opTokens -= opRate != 0 ? 1000 : 0;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return byteWait > opWait ? byteWait : opWait;
+}
+#endif
+
+PRIVATE void initialiseKeyTable(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_KEY; i++)
+    {
+        keyTable.slots[i].id = AES_KEY_HANDLE_NONE;
+        keyTable.slots[i].generation = 1;
+
+        /* Pop order starts from the first slot */
+        keyTable.freeSlots[i] = (uint8_t)(CFG_US_TINYAES_MAX_NUM_OF_KEY - 1 - i);
+    }
+
+    keyTable.freeSlotCount = CFG_US_TINYAES_MAX_NUM_OF_KEY;
+}
+
+PRIVATE ALWAYS_INLINE AESKey* allocateKey(uint8_t receiverID)
+{
+    AESKey* key = NULL;
+    uint32_t slot;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    if (keyTable.freeSlotCount > 0)
+    {
+        slot = keyTable.freeSlots[--keyTable.freeSlotCount];
+        key = &keyTable.slots[slot];
+
+        key->id = AES_HANDLE_MAKE(key->generation, slot, receiverID) | AES_HANDLE_TYPE_KEY;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return key;
+}
+
+PRIVATE ALWAYS_INLINE void releaseKey(AESKey* key)
+{
+    uint32_t slot = AES_HANDLE_GET_SLOT(key->id);
+
+    memset(&key->schedule, 0, sizeof(key->schedule));
+
+    key->id = AES_KEY_HANDLE_NONE;
+    key->generation = AES_HANDLE_NEXT_GENERATION(key->generation);
+
+    AES_ENTER_CRITICAL_SECTION();
+    keyTable.freeSlots[keyTable.freeSlotCount++] = (uint8_t)slot;
+    AES_EXIT_CRITICAL_SECTION();
+}
+
+/*
+ * Validates a key handle in O(1) and returns the key
+ *
+ * @param receiverID Requester ID; must be the owner of the key
+ * @param keyHandle Key Handle
+ * @param[out] key Key if the handle is valid
+ *
+ * @retval usTinyAESOp_Success Valid Key
+ * @retval usTinyAESOp_InvalidKey Not active, stale or not owned by the requester
+ */
+PRIVATE ALWAYS_INLINE usTinyAESStatus getKey(uint8_t receiverID, uint32_t keyHandle, AESKey** key)
+{
+    uint32_t slot = AES_HANDLE_GET_SLOT(keyHandle);
+
+    if (slot >= CFG_US_TINYAES_MAX_NUM_OF_KEY ||
+        keyTable.slots[slot].id == AES_KEY_HANDLE_NONE ||
+        keyTable.slots[slot].id != keyHandle ||
+        AES_HANDLE_GET_OWNER(keyHandle) != receiverID)
+    {
+        return usTinyAESOp_InvalidKey;
+    }
+
+    *key = &keyTable.slots[slot];
+
+    return usTinyAESOp_Success;
+}
+
+PRIVATE ALWAYS_INLINE bool isValidAlgorithm(uint32_t alg, uint32_t* blockSize)
+{
+#if SUPPORT_ONLY_CBC256
+    if (alg != usTinyAESAlg_AES_CBC_256)
+    {
+        return false;
+    }
+
+    *blockSize = AES_BLOCKLEN;
+
+    return true;
+#else
+    #error "Unsupported yet"
+#endif
+}
+
+PRIVATE ALWAYS_INLINE bool isValidKey(uint32_t keyLen)
+{
+#if SUPPORT_ONLY_CBC256
+    return keyLen == MAX_KEY_SIZE;
+#else
+    #error "Unsupported yet"
+#endif
+}
+
+PRIVATE ALWAYS_INLINE bool isValidIV(uint32_t ivLen)
+{
+#if SUPPORT_ONLY_CBC256
+    return ivLen == MAX_IV_SIZE;
+#else
+    #error "Unsupported yet"
+#endif
+}
+
+/*
+ * Initialises an AES Context with the raw key and IV; expands the key
+ */
+PRIVATE usTinyAESStatus initialiseContext(usTinyAESPayloadOpenSession* params, struct AES_ctx* ctx, usTinyAESAlg* alg, uint32_t* blockSize)
+{
+    if (!isValidAlgorithm(params->alg, blockSize))
+    {
+        return usTinyAESOp_UnsupportedOperation;
+    }
+
+    if (!isValidKey(params->keyLen) || !isValidIV(params->ivLen))
+    {
+        return usTinyAESOp_InvalidParam_Key;
+    }
+
+    AES_init_ctx_iv(ctx, params->key, params->iv);
+    *alg = (usTinyAESAlg)params->alg;
+
+    return usTinyAESOp_Success;
+}
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+#define AES_KEY_STORE_STORAGE_OFFSET(_index) \
+            (CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET + (_index) * (uint32_t)sizeof(AESSealedSession))
+
+/* Usage counters and generations follow the sealed keys */
+#define AES_KEY_STORE_USES_STORAGE_OFFSET       AES_KEY_STORE_STORAGE_OFFSET(CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY)
+#define AES_KEY_STORE_GENERATIONS_STORAGE_OFFSET (AES_KEY_STORE_USES_STORAGE_OFFSET + (uint32_t)sizeof(keyStore.uses))
+#define AES_KEY_STORE_STORAGE_END               (AES_KEY_STORE_GENERATIONS_STORAGE_OFFSET + (uint32_t)sizeof(keyStore.generations))
+
+/* Matches the Storage Layout */
+typedef char uS_KeyStoreSizeCheck[(AES_KEY_STORE_STORAGE_END - CFG_US_TINYAES_KEY_STORE_STORAGE_OFFSET == AES_KEY_STORE_STORAGE_SIZE) ? 1 : -1];
+
+/*
+ * Checks whether the requester is the owner of a stored key. The Execution
+ * Index of the owner is resolved from its name once per boot; an owner which
+ * is not installed yet is resolved when it first uses the key.
+ */
+PRIVATE ALWAYS_INLINE bool isStoredKeyOwner(AESStoredKey* key, uint8_t receiverID)
+{
+    uint32_t execIndex;
+
+    if (!key->ownerResolved &&
+        Sys_GetExecutionIndexByName(key->owner, &execIndex) == SysStatus_Success)
+    {
+        key->ownerID = (uint8_t)execIndex;
+        key->ownerResolved = true;
+    }
+
+    return key->ownerResolved && key->ownerID == receiverID;
+}
+
+/*
+ * Validates a Stored Key ID in O(1); the caller is in the critical section
+ */
+PRIVATE ALWAYS_INLINE bool isStoredKey(uint8_t receiverID, uint32_t keyID)
+{
+    uint32_t index = AES_HANDLE_GET_SLOT(keyID);
+
+    return AES_HANDLE_IS_STORED_KEY(keyID) &&
+           index < CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY &&
+           keyStore.keys[index].id == keyID &&
+           isStoredKeyOwner(&keyStore.keys[index], receiverID);
+}
+
+/*
+ * Reads a stored key from the storage and unseals it
+ *
+ * @return false if it cannot be read, is modified, is deleted or is not the
+ *         key of the place
+ */
+PRIVATE bool readStoredKey(uint32_t index, AESSealedSession* sealed)
+{
+    if (Sys_StorageRead(AES_KEY_STORE_STORAGE_OFFSET(index), sizeof(AESSealedSession), (uint8_t*)sealed) != SysStatus_Success ||
+        sealed->id != AES_STORED_KEY_ID(keyStore.generations[index], index) ||
+        !unsealSession(&deviceKeys.storage, sealed))
+    {
+        memset(sealed, 0, sizeof(AESSealedSession));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Gets the cache entry of a stored key. If it is not in the cache, the least
+ * recently used entry is returned to be replaced. The caller is in the
+ * critical section.
+ */
+PRIVATE AESCachedKey* getCachedKey(uint32_t keyID, bool* cached)
+{
+    AESCachedKey* entry = &keyStore.cache[0];
+    uint32_t i;
+
+    for (i = 0; i < CFG_US_TINYAES_KEY_STORE_CACHE_SIZE; i++)
+    {
+        if (keyStore.cache[i].id == keyID)
+        {
+            *cached = true;
+            return &keyStore.cache[i];
+        }
+
+        /* Empty entries are never used, so they are taken first */
+        if (keyStore.cache[i].lastUsed < entry->lastUsed)
+        {
+            entry = &keyStore.cache[i];
+        }
+    }
+
+    *cached = false;
+
+    return entry;
+}
+
+PRIVATE void expandStoredKey(AESCachedKey* entry, AESSealedSession* sealed)
+{
+    entry->id = sealed->id;
+    entry->alg = (usTinyAESAlg)sealed->alg;
+    entry->blockSize = sealed->blockSize;
+
+    AES_init_ctx(&entry->schedule, sealed->key);
+}
+
+/*
+ * Writes the usage counters if they are changed and not written for
+ * CFG_US_TINYAES_KEY_STORE_USAGE_SAVE_PERIOD_MS. The caller is in the
+ * critical section.
+ */
+PRIVATE void saveKeyStoreUsage(void)
+{
+    uint64_t now = Sys_GetTimeInMs();
+    SysStatus retVal;
+
+    if (!keyStore.usesChanged || now - keyStore.usesSaved < CFG_US_TINYAES_KEY_STORE_USAGE_SAVE_PERIOD_MS)
+    {
+        return;
+    }
+
+    /* Not retried before the next period on a failure either */
+    keyStore.usesSaved = now;
+
+    retVal = Sys_StorageWrite(AES_KEY_STORE_USES_STORAGE_OFFSET, sizeof(keyStore.uses), (uint8_t*)keyStore.uses);
+    if (retVal != SysStatus_Success)
+    {
+        LOG_WARNING("Key Store Usage cannot be saved! %d", retVal);
+        return;
+    }
+
+    keyStore.usesChanged = false;
+}
+
+/*
+ * Builds the index of the Key Store from the storage and expands the most
+ * used keys into the cache, so they are ready before any request arrives
+ */
+PRIVATE SysStatus initialiseKeyStore(void)
+{
+    AESSealedSession sealed;
+    AESCachedKey* entry;
+    SysStatus retVal;
+    uint32_t i;
+    uint32_t j;
+
+    retVal = Sys_StorageRead(AES_KEY_STORE_USES_STORAGE_OFFSET, sizeof(keyStore.uses), (uint8_t*)keyStore.uses);
+    if (retVal == SysStatus_Success)
+    {
+        retVal = Sys_StorageRead(AES_KEY_STORE_GENERATIONS_STORAGE_OFFSET, sizeof(keyStore.generations), (uint8_t*)keyStore.generations);
+    }
+
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    for (i = 0; i < CFG_US_TINYAES_KEY_STORE_CACHE_SIZE; i++)
+    {
+        keyStore.cache[i].id = AES_KEY_HANDLE_NONE;
+        keyStore.cache[i].lastUsed = 0;
+    }
+
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY; i++)
+    {
+        keyStore.keys[i].id = AES_KEY_HANDLE_NONE;
+
+        /* A free place is never written, or cleared by usTinyAESOp_DeleteKey */
+        if (!readStoredKey(i, &sealed))
+        {
+            keyStore.uses[i] = 0;
+            continue;
+        }
+
+        keyStore.keys[i].id = sealed.id;
+        keyStore.keys[i].sequence = sealed.sequence;
+        memcpy(keyStore.keys[i].owner, sealed.iv, SYS_EXEC_NAME_MAX_LENGTH);
+        keyStore.keys[i].ownerResolved = false;
+
+        /* Keep the most used keys seen so far in the cache */
+        entry = &keyStore.cache[0];
+        for (j = 0; j < CFG_US_TINYAES_KEY_STORE_CACHE_SIZE && entry->id != AES_KEY_HANDLE_NONE; j++)
+        {
+            if (keyStore.cache[j].id == AES_KEY_HANDLE_NONE ||
+                keyStore.uses[AES_HANDLE_GET_SLOT(keyStore.cache[j].id)] < keyStore.uses[AES_HANDLE_GET_SLOT(entry->id)])
+            {
+                entry = &keyStore.cache[j];
+            }
+        }
+
+        if (entry->id == AES_KEY_HANDLE_NONE ||
+            keyStore.uses[AES_HANDLE_GET_SLOT(entry->id)] < keyStore.uses[i])
+        {
+            expandStoredKey(entry, &sealed);
+        }
+
+        memset(&sealed, 0, sizeof(sealed));
+    }
+
+    keyStore.usesChanged = false;
+    keyStore.usesSaved = Sys_GetTimeInMs();
+
+    return SysStatus_Success;
+}
+
+/*
+ * Seals a key into a free place of the Key Store. The key is also put into
+ * the cache, as it is likely to be used soon.
+ *
+ * @param receiverID Requester ID
+ * @param ownerName Requester Execution Name; the key is bound to it
+ */
+PRIVATE usTinyAESStatus storeKey(uint8_t receiverID, const char* ownerName, usTinyAESPayloadImportKey* storeKey, uint32_t* keyID)
+{
+    usTinyAESStatus status = usTinyAESOp_Success;
+    AESSealedSession sealed;
+    AESCachedKey* entry;
+    uint32_t blockSize;
+    uint32_t index;
+    uint32_t id;
+    bool cached;
+
+    if (!isValidAlgorithm(storeKey->alg, &blockSize))
+    {
+        return usTinyAESOp_UnsupportedOperation;
+    }
+
+    if (!isValidKey(storeKey->keyLen))
+    {
+        return usTinyAESOp_InvalidParam_Key;
+    }
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    for (index = 0; index < CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY; index++)
+    {
+        if (keyStore.keys[index].id == AES_KEY_HANDLE_NONE)
+        {
+            break;
+        }
+    }
+
+    if (index == CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY)
+    {
+        AES_EXIT_CRITICAL_SECTION();
+        return usTinyAESOp_NoKeySlotAvailable;
+    }
+
+    id = AES_STORED_KEY_ID(keyStore.generations[index], index);
+
+    entry = getCachedKey(id, &cached);
+    entry->id = id;
+    entry->alg = (usTinyAESAlg)storeKey->alg;
+    entry->blockSize = blockSize;
+    entry->lastUsed = Sys_GetTimeInMs();
+
+    AES_init_ctx(&entry->schedule, storeKey->key);
+
+    /* The owner is sealed in place of the IV; sessions set their own IV */
+    memset(entry->schedule.Iv, 0, AES_BLOCKLEN);
+    memcpy(entry->schedule.Iv, ownerName, SYS_EXEC_NAME_MAX_LENGTH);
+    sealSession(&deviceKeys.storage, id, entry->alg, blockSize, &entry->schedule, &sealed);
+    memset(entry->schedule.Iv, 0, AES_BLOCKLEN);
+
+    if (Sys_StorageWrite(AES_KEY_STORE_STORAGE_OFFSET(index), sizeof(sealed), (uint8_t*)&sealed) != SysStatus_Success)
+    {
+        memset(entry, 0, sizeof(AESCachedKey));
+        status = usTinyAESOp_StorageError;
+    }
+    else
+    {
+        keyStore.keys[index].id = id;
+        keyStore.keys[index].sequence = sealed.sequence;
+        memcpy(keyStore.keys[index].owner, ownerName, SYS_EXEC_NAME_MAX_LENGTH);
+        keyStore.keys[index].ownerID = receiverID;
+        keyStore.keys[index].ownerResolved = true;
+
+        keyStore.uses[index] = 0;
+        keyStore.usesChanged = true;
+
+        *keyID = id;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    memset(&sealed, 0, sizeof(sealed));
+
+    return status;
+}
+
+/*
+ * Deletes a stored key. The generation of its place is persisted first, so the
+ * ID is invalid even if the record cannot be cleared.
+ */
+PRIVATE usTinyAESStatus deleteKey(uint8_t receiverID, uint32_t keyID)
+{
+    usTinyAESStatus status = usTinyAESOp_Success;
+    AESSealedSession cleared;
+    AESCachedKey* entry;
+    uint32_t index = AES_HANDLE_GET_SLOT(keyID);
+    uint16_t generation;
+    bool cached;
+
+    memset(&cleared, 0, sizeof(cleared));
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    if (!isStoredKey(receiverID, keyID))
+    {
+        status = usTinyAESOp_InvalidKey;
+    }
+    else
+    {
+        generation = (uint16_t)((keyStore.generations[index] + 1) & AES_HANDLE_GENERATION_MASK);
+
+        if (Sys_StorageWrite(AES_KEY_STORE_GENERATIONS_STORAGE_OFFSET + index * (uint32_t)sizeof(generation),
+                             sizeof(generation), (uint8_t*)&generation) != SysStatus_Success)
+        {
+            status = usTinyAESOp_StorageError;
+        }
+    }
+
+    if (status == usTinyAESOp_Success)
+    {
+        keyStore.generations[index] = generation;
+        keyStore.keys[index].id = AES_KEY_HANDLE_NONE;
+
+        /* Not to leave the sealed key behind */
+        (void)Sys_StorageWrite(AES_KEY_STORE_STORAGE_OFFSET(index), sizeof(cleared), (uint8_t*)&cleared);
+
+        entry = getCachedKey(keyID, &cached);
+        if (cached)
+        {
+            memset(entry, 0, sizeof(AESCachedKey));
+        }
+
+        keyStore.uses[index] = 0;
+        keyStore.usesChanged = true;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return status;
+}
+
+/*
+ * Copies the schedule of a stored key. A key which is not in the cache is
+ * read from the storage and expanded into the least recently used entry.
+ */
+PRIVATE usTinyAESStatus getStoredKey(uint8_t receiverID, uint32_t keyID, struct AES_ctx* ctx, usTinyAESAlg* alg, uint32_t* blockSize)
+{
+    usTinyAESStatus status = usTinyAESOp_Success;
+    AESSealedSession sealed;
+    AESCachedKey* entry;
+    uint32_t index = AES_HANDLE_GET_SLOT(keyID);
+    bool cached;
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    if (!isStoredKey(receiverID, keyID))
+    {
+        AES_EXIT_CRITICAL_SECTION();
+        return usTinyAESOp_InvalidKey;
+    }
+
+    entry = getCachedKey(keyID, &cached);
+    if (!cached)
+    {
+        if (!readStoredKey(index, &sealed) ||
+            sealed.id != keyID || sealed.sequence != keyStore.keys[index].sequence)
+        {
+            LOG_WARNING("Stored Key 0x%x cannot be loaded", keyID);
+            status = usTinyAESOp_StorageError;
+        }
+        else
+        {
+            expandStoredKey(entry, &sealed);
+        }
+
+        memset(&sealed, 0, sizeof(sealed));
+    }
+
+    if (status == usTinyAESOp_Success)
+    {
+        *ctx = entry->schedule;
+        *alg = entry->alg;
+        *blockSize = entry->blockSize;
+
+        entry->lastUsed = Sys_GetTimeInMs();
+
+        keyStore.uses[index]++;
+        keyStore.usesChanged = true;
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return status;
+}
+#endif
+
+/*
+ * Copies the expanded key of an imported, a stored or the device key
+ */
+PRIVATE usTinyAESStatus getKeySchedule(uint8_t receiverID, uint32_t keyHandle, struct AES_ctx* ctx, usTinyAESAlg* alg, uint32_t* blockSize)
+{
+    AESKey* key;
+    usTinyAESStatus status;
+
+#if CFG_US_TINYAES_DEVICE_KEY
+    if (keyHandle == US_TINYAES_DEVICE_KEY_HANDLE)
+    {
+        if (!CFG_US_TINYAES_DEVICE_KEY_ALLOWED(receiverID))
+        {
+            return usTinyAESOp_InvalidKey;
+        }
+
+        /* Never changes after the startup */
+        *ctx = deviceKeys.client;
+        *alg = usTinyAESAlg_AES_CBC_256;
+        *blockSize = AES_BLOCKLEN;
+
+        return usTinyAESOp_Success;
+    }
+#endif
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    if (AES_HANDLE_IS_STORED_KEY(keyHandle))
+    {
+        return getStoredKey(receiverID, keyHandle, ctx, alg, blockSize);
+    }
+#endif
+
+    status = getKey(receiverID, keyHandle, &key);
+    if (status == usTinyAESOp_Success)
+    {
+        *ctx = key->schedule;
+        *alg = key->alg;
+        *blockSize = key->blockSize;
+    }
+
+    return status;
+}
+
+/*
+ * Initialises an AES Context with an imported, a stored or the device key and
+ * an IV; the expanded key is copied, so there is no key expansion
+ */
+PRIVATE usTinyAESStatus initialiseContextWithKey(uint8_t receiverID, usTinyAESPayloadOpenSessionWithKey* params, struct AES_ctx* ctx, usTinyAESAlg* alg, uint32_t* blockSize)
+{
+    usTinyAESStatus status;
+
+    status = getKeySchedule(receiverID, params->keyHandle, ctx, alg, blockSize);
+    if (status != usTinyAESOp_Success)
+    {
+        return status;
+    }
+
+    if (!isValidIV(params->ivLen))
+    {
+        return usTinyAESOp_InvalidParam_Key;
+    }
+
+    AES_ctx_set_iv(ctx, params->iv);
+
+    return usTinyAESOp_Success;
+}
+
+/*
+ * Opens a session either with the raw key (openSession) or with an imported
+ * key (openSessionWithKey); only one of them is given
+ */
+PRIVATE usTinyAESStatus openSession(uint8_t receiverID,
+                                    usTinyAESPayloadOpenSession* openSession,
+                                    usTinyAESPayloadOpenSessionWithKey* openSessionWithKey,
+                                    uint32_t* sessionID)
+{
+    AESSession* session;
+    usTinyAESStatus status;
+
+    session = allocateSession(receiverID);
+    if (session == NULL)
+    {
+        return usTinyAESOp_NoSessionSlotAvailable;
+    }
+
+    /* Initialise the AES Context */
+    if (openSession != NULL)
+    {
+        status = initialiseContext(openSession, &session->ctx, &session->alg, &session->blockSize);
+    }
+    else
+    {
+        status = initialiseContextWithKey(receiverID, openSessionWithKey, &session->ctx, &session->alg, &session->blockSize);
+    }
+
+    if (status != usTinyAESOp_Success)
+    {
+        releaseSession(session);
+        return status;
+    }
+
+    *sessionID = session->id;
+
+    return usTinyAESOp_Success;
+}
+
+/*
+ * Expands the key once and keeps it for the sessions and one-shot operations
+ */
+PRIVATE usTinyAESStatus importKey(uint8_t receiverID, usTinyAESPayloadImportKey* importKey, uint32_t* keyHandle)
+{
+    uint32_t blockSize;
+    AESKey* key;
+
+    if (!isValidAlgorithm(importKey->alg, &blockSize))
+    {
+        return usTinyAESOp_UnsupportedOperation;
+    }
+
+    if (!isValidKey(importKey->keyLen))
+    {
+        return usTinyAESOp_InvalidParam_Key;
+    }
+
+    key = allocateKey(receiverID);
+    if (key == NULL)
+    {
+        return usTinyAESOp_NoKeySlotAvailable;
+    }
+
+    AES_init_ctx(&key->schedule, importKey->key);
+
+    key->alg = (usTinyAESAlg)importKey->alg;
+    key->blockSize = blockSize;
+
+    *keyHandle = key->id;
+
+    return usTinyAESOp_Success;
+}
+
+#if CFG_US_TINYAES_KEY_DERIVATION
+/*
+ * Derives a child key from a parent key with the SP 800-108 KDF; the parent
+ * key is the KDF key. The child key is expanded once into the Key Table like
+ * an imported key.
+ *
+ * The device key is shared, so a key derived from it is bound to the
+ * requester; the KDF context is the Execution Name followed by the context.
+ *
+ * @param receiverID Requester ID
+ * @param senderName Requester Execution Name; only used with the device key
+ */
+PRIVATE usTinyAESStatus deriveKeyHandle(uint8_t receiverID, const char* senderName, usTinyAESPayloadDeriveKey* params, uint32_t* keyHandle)
+{
+    uint8_t context[SYS_EXEC_NAME_MAX_LENGTH + US_TINYAES_DERIVE_MAX_CONTEXT_SIZE];
+    uint32_t contextLen = 0;
+    uint8_t childKey[AES_KEYLEN];
+    usTinyAESStatus status;
+    usTinyAESAlg alg;
+    uint32_t blockSize;
+    AESCMAC kdk;
+    AESKey* key;
+    uint32_t i;
+#if !CFG_US_TINYAES_DEVICE_KEY
+    (void)senderName;
+#endif
+
+    if (params->labelLen > US_TINYAES_DERIVE_MAX_LABEL_SIZE ||
+        params->contextLen > US_TINYAES_DERIVE_MAX_CONTEXT_SIZE)
+    {
+        return usTinyAESOp_InvalidParam_SizeExceedAllowed;
+    }
+
+    /* The zero byte separates the label from the context */
+    for (i = 0; i < params->labelLen; i++)
+    {
+        if (params->label[i] == 0x00)
+        {
+            return usTinyAESOp_InvalidParam_Label;
+        }
+    }
+
+#if CFG_US_TINYAES_DEVICE_KEY
+    if (params->parentKeyHandle == US_TINYAES_DEVICE_KEY_HANDLE)
+    {
+        /* Not bound without the name; see Sys_ReceiveMessageByName() */
+        if (senderName[0] == '\0')
+        {
+            return usTinyAESOp_InvalidKey;
+        }
+
+        memcpy(context, senderName, SYS_EXEC_NAME_MAX_LENGTH);
+        contextLen = SYS_EXEC_NAME_MAX_LENGTH;
+
+        /* Never changes after the startup */
+        kdk.ctx = deviceKeys.client;
+        alg = usTinyAESAlg_AES_CBC_256;
+        blockSize = AES_BLOCKLEN;
+    }
+    else
+#endif
+    {
+        status = getKeySchedule(receiverID, params->parentKeyHandle, &kdk.ctx, &alg, &blockSize);
+        if (status != usTinyAESOp_Success)
+        {
+            return status;
+        }
+    }
+
+    memcpy(&context[contextLen], params->context, params->contextLen);
+    contextLen += params->contextLen;
+
+    key = allocateKey(receiverID);
+    if (key == NULL)
+    {
+        memset(&kdk, 0, sizeof(kdk));
+        return usTinyAESOp_NoKeySlotAvailable;
+    }
+
+    /* The parent schedule is used as is; no key expansion for the KDF key */
+    initialiseCMACSubkeys(&kdk);
+    deriveKey(&kdk, params->label, params->labelLen, context, contextLen, childKey);
+
+    AES_init_ctx(&key->schedule, childKey);
+
+    key->alg = alg;
+    key->blockSize = blockSize;
+
+    memset(childKey, 0, sizeof(childKey));
+    memset(&kdk, 0, sizeof(kdk));
+
+    *keyHandle = key->id;
+
+    return usTinyAESOp_Success;
+}
+#endif
+
+PRIVATE usTinyAESStatus releaseKeyHandle(uint8_t receiverID, uint32_t keyHandle)
+{
+    AESKey* key;
+
+    if (getKey(receiverID, keyHandle, &key) != usTinyAESOp_Success)
+    {
+        return usTinyAESOp_InvalidKey;
+    }
+
+    releaseKey(key);
+
+    return usTinyAESOp_Success;
+}
+
+/*
+ * Resets the session IV; the expanded key is kept
+ */
+PRIVATE usTinyAESStatus setIV(uint8_t receiverID, usTinyAESPayloadSetIV* setIV)
+{
+    AESSession* session;
+    usTinyAESStatus status;
+
+    status = getSession(receiverID, setIV->sessionID, &session);
+    if (status != usTinyAESOp_Success)
+    {
+        return status;
+    }
+
+    if (!isValidIV(setIV->ivLen))
+    {
+        return usTinyAESOp_InvalidParam_Key;
+    }
+
+    AES_ctx_set_iv(&session->ctx, setIV->iv);
+
+    return usTinyAESOp_Success;
+}
+
+PRIVATE usTinyAESStatus setSessionPriority(uint8_t receiverID, usTinyAESPayloadSetSessionPriority* params)
+{
+    AESSession* session;
+    usTinyAESStatus status;
+
+    if (params->priority > usTinyAESPriority_Bulk)
+    {
+        return usTinyAESOp_InvalidOperation;
+    }
+
+    status = getSession(receiverID, params->sessionID, &session);
+    if (status != usTinyAESOp_Success)
+    {
+        return status;
+    }
+
+    /* Read by the dispatcher; see getLane() */
+    AES_ENTER_CRITICAL_SECTION();
+    session->priority = (uint8_t)params->priority;
+    AES_EXIT_CRITICAL_SECTION();
+
+    return usTinyAESOp_Success;
+}
+
+PRIVATE usTinyAESStatus closeSession(uint8_t receiverID, uint32_t sessionID)
+{
+    AESSession* session;
+    usTinyAESStatus status = usTinyAESOp_Success;
+
+    /* Not to release a session which is closed as idle meanwhile */
+    AES_ENTER_CRITICAL_SECTION();
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    /* A spilled session is not restored only to be closed */
+    if (AES_HANDLE_GET_OWNER(sessionID) == receiverID && dropSpilledSession(sessionID))
+    {
+        AES_EXIT_CRITICAL_SECTION();
+        return usTinyAESOp_Success;
+    }
+#endif
+
+    if (getSession(receiverID, sessionID, &session) != usTinyAESOp_Success)
+    {
+        status = usTinyAESOp_InvalidSession;
+    }
+    else
+    {
+        releaseSession(session);
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return status;
+}
+
+/*
+ * Validates an Encryption/Decryption request
+ *
+ * @param receiverID Requester ID
+ * @param sessionID Session Handle
+ * @param length Data length in the request
+ * @param dataLen Actual data length in the message
+ * @param[out] session Session if the request is valid
+ */
+PRIVATE usTinyAESStatus getEncDecSession(uint8_t receiverID, uint32_t sessionID, uint32_t length, uint32_t dataLen, AESSession** session)
+{
+    usTinyAESStatus status;
+
+    status = getSession(receiverID, sessionID, session);
+    if (status != usTinyAESOp_Success)
+    {
+        return status;
+    }
+
+    if (length != dataLen)
+    {
+        return usTinyAESOp_InvalidParam_UnsufficientSize;
+    }
+
+    if (dataLen > AES_ENC_DEC_MAX_DATA_LEN)
+    {
+        return usTinyAESOp_InvalidParam_SizeExceedAllowed;
+    }
+
+    if ((dataLen % (*session)->blockSize) != 0)
+    {
+        return usTinyAESOp_InvalidParam_UnalignedSize;
+    }
+
+    return usTinyAESOp_Success;
+}
+
+PRIVATE ALWAYS_INLINE void cipher(struct AES_ctx* ctx, bool encrypt, uint8_t* data, uint32_t len)
+{
+    if (encrypt)
+    {
+        AES_CBC_encrypt_buffer(ctx, data, len);
+    }
+    else
+    {
+        AES_CBC_decrypt_buffer(ctx, data, len);
+    }
+}
+
+/*
+ * Receives the data of the current message in block aligned chunks and
+ * transforms each chunk in place as soon as it is received
+ */
+PRIVATE void receiveAndCipher(AESJob* job, struct AES_ctx* ctx, bool encrypt, uint8_t* buffer, uint32_t len)
+{
+    uint32_t offset;
+    uint32_t chunkLen;
+
+    for (offset = 0; offset < len; offset += chunkLen)
+    {
+        chunkLen = (len - offset) < CFG_US_TINYAES_RECEIVE_CHUNK_LEN ?
+                        (len - offset) : CFG_US_TINYAES_RECEIVE_CHUNK_LEN;
+
+        receivePayload(job, &buffer[offset], chunkLen);
+
+        cipher(ctx, encrypt, &buffer[offset], chunkLen);
+    }
+}
+
+/*
+ * Validates an Encryption/Decryption request and gets its session. A new IV in
+ * the request is received and set; the data is left to be received.
+ *
+ * @return false if the request is invalid; the error is already sent
+ */
+PRIVATE bool startEncDec(AESJob* job, AESSession** sessionOut, uint32_t* dataLenOut)
+{
+    uint8_t receiverID = job->senderID;
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t payloadLen = job->payloadLen;
+    AESSession* session;
+    usTinyAESStatus status;
+    uint32_t ivLen;
+    uint32_t dataLen;
+
+    if (payloadLen < AES_ENC_DEC_FIXED_SIZE)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return false;
+    }
+
+    receivePayload(job, (uint8_t*)&request->payload.encDec, AES_ENC_DEC_FIXED_SIZE);
+    payloadLen -= AES_ENC_DEC_FIXED_SIZE;
+
+    ivLen = (request->payload.encDec.flags & AES_ENC_DEC_FLAG_IV) ? MAX_IV_SIZE : 0;
+    if (payloadLen < ivLen)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return false;
+    }
+    dataLen = payloadLen - ivLen;
+
+    status = getEncDecSession(receiverID, request->payload.encDec.sessionID, request->payload.encDec.length, dataLen, &session);
+    if (status != usTinyAESOp_Success)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, status);
+        return false;
+    }
+
+    if (ivLen > 0)
+    {
+        uint8_t iv[MAX_IV_SIZE];
+
+        receivePayload(job, iv, ivLen);
+        AES_ctx_set_iv(&session->ctx, iv);
+    }
+
+    *sessionOut = session;
+    *dataLenOut = dataLen;
+
+    return true;
+}
+
+/*
+ * Sends the request buffer back as the Encryption/Decryption response
+ */
+PRIVATE ALWAYS_INLINE void sendEncDec(AESJob* job, uint32_t dataLen)
+{
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+
+    request->payload.encDec.flags = 0;
+    request->header.status = usTinyAESOp_Success;
+    request->header.length = AES_PACKAGE_ENC_DEC_SIZE(dataLen);
+    (void)Sys_SendMessage(job->senderID, (uint8_t*)request, request->header.length, &sequenceNo);
+}
+
+/*
+ * Encrypts/Decrypts the data in the request while it is being received.
+ *
+ * Only the fixed part of the payload is received first to validate the request;
+ * then the data is received in block aligned chunks directly into the request
+ * buffer and transformed in place, so the request buffer is sent back as the
+ * response without any copy.
+ *
+ * A new IV in the request is received separately before the data, so the data
+ * still lands at the beginning of the buffer.
+ */
+PRIVATE void processEncDec(AESJob* job)
+{
+    AESSession* session;
+    uint32_t dataLen;
+
+    if (!startEncDec(job, &session, &dataLen))
+    {
+        return;
+    }
+
+    receiveAndCipher(job, &session->ctx, job->package.header.operation == usTinyAESOp_Encrypt, job->package.payload.encDec.buffer, dataLen);
+
+    sendEncDec(job, dataLen);
+}
+
+/*
+ * Encrypts/Decrypts the data with the key (or the imported key) and IV in the
+ * request without a session.
+ *
+ * The key is expanded (or the imported key is copied) into a scratch context;
+ * then the data is received and transformed like processEncDec(). The data is
+ * received over the key material in the request buffer, so the response has
+ * the usTinyAESPayloadEncDec layout without any copy and the key is not sent back.
+ */
+PRIVATE void processOneShot(AESJob* job)
+{
+    uint8_t receiverID = job->senderID;
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t payloadLen = job->payloadLen;
+    bool withKey = request->header.operation == usTinyAESOp_EncryptOneShotWithKey ||
+                   request->header.operation == usTinyAESOp_DecryptOneShotWithKey;
+    bool encrypt = request->header.operation == usTinyAESOp_EncryptOneShot ||
+                   request->header.operation == usTinyAESOp_EncryptOneShotWithKey;
+    uint32_t fixedSize = withKey ? AES_ONESHOT_WITHKEY_FIXED_SIZE : AES_ONESHOT_FIXED_SIZE;
+    uint32_t maxDataLen = withKey ? AES_ONESHOT_WITHKEY_MAX_DATA_LEN : AES_ONESHOT_MAX_DATA_LEN;
+    struct AES_ctx ctx;
+    usTinyAESStatus status;
+    usTinyAESAlg alg;
+    uint32_t blockSize;
+    uint32_t length;
+    uint32_t dataLen;
+
+    if (payloadLen < fixedSize)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return;
+    }
+
+    receivePayload(job, (uint8_t*)&request->payload, fixedSize);
+    dataLen = payloadLen - fixedSize;
+
+    if (withKey)
+    {
+        status = initialiseContextWithKey(receiverID, &request->payload.oneShotWithKey.params, &ctx, &alg, &blockSize);
+        length = request->payload.oneShotWithKey.length;
+    }
+    else
+    {
+        status = initialiseContext(&request->payload.oneShot.params, &ctx, &alg, &blockSize);
+        length = request->payload.oneShot.length;
+    }
+    memset(&request->payload, 0, fixedSize);
+
+    if (status == usTinyAESOp_Success)
+    {
+        if (length != dataLen)
+        {
+            status = usTinyAESOp_InvalidParam_UnsufficientSize;
+        }
+        else if (dataLen > maxDataLen)
+        {
+            status = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+        }
+        else if ((dataLen % blockSize) != 0)
+        {
+            status = usTinyAESOp_InvalidParam_UnalignedSize;
+        }
+    }
+
+    if (status != usTinyAESOp_Success)
+    {
+        memset(&ctx, 0, sizeof(ctx));
+        discardPayload(job, dataLen);
+        sendError(receiverID, &request->header, status);
+        return;
+    }
+
+    receiveAndCipher(job, &ctx, encrypt, request->payload.encDec.buffer, dataLen);
+    memset(&ctx, 0, sizeof(ctx));
+
+    /* Send the response */
+    {
+        uint32_t sequenceNo;
+        (void)sequenceNo;
+
+        request->payload.encDec.sessionID = AES_SESSION_ID_NOT_ACTIVE;
+        request->payload.encDec.length = (uint16_t)dataLen;
+        request->payload.encDec.flags = 0;
+
+        request->header.status = usTinyAESOp_Success;
+        request->header.length = AES_PACKAGE_ENC_DEC_SIZE(dataLen);
+        (void)Sys_SendMessage(receiverID, (uint8_t*)request, request->header.length, &sequenceNo);
+    }
+}
+
+#if CFG_US_TINYAES_SESSION_TICKETS
+/*
+ * Opens a session ticket; the context is initialised like a session but it
+ * is sealed into the response instead of a session slot. The request buffer
+ * is sent back as the response.
+ */
+PRIVATE void openSessionTicket(uint8_t receiverID, usTinyAESRequestPackage* request)
+{
+    AESSealedSession* sealed = (AESSealedSession*)request->payload.ticketEncDec.ticket;
+    struct AES_ctx ctx;
+    usTinyAESStatus status;
+    usTinyAESAlg alg;
+    uint32_t blockSize;
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+
+    status = initialiseContext(&request->payload.openSession, &ctx, &alg, &blockSize);
+
+    /* Do not leave the raw key in the request buffer */
+    memset(&request->payload.openSession, 0, sizeof(request->payload.openSession));
+
+    if (status != usTinyAESOp_Success)
+    {
+        sendError(receiverID, &request->header, status);
+        return;
+    }
+
+    sealSession(&deviceKeys.boot, receiverID, alg, blockSize, &ctx, sealed);
+    memset(&ctx, 0, sizeof(ctx));
+
+    request->header.status = usTinyAESOp_Success;
+    request->header.length = AES_RESPONSE_TICKET_SIZE;
+    (void)Sys_SendMessage(receiverID, (uint8_t*)request, request->header.length, &sequenceNo);
+}
+
+/*
+ * Encrypts/Decrypts the data in the request with the state in the session
+ * ticket. The ticket is verified and the key is expanded for every request;
+ * the data is transformed in place like processEncDec() and the request
+ * buffer is sent back with the updated ticket.
+ */
+PRIVATE void processTicketEncDec(AESJob* job)
+{
+    uint8_t receiverID = job->senderID;
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t payloadLen = job->payloadLen;
+    AESSealedSession* sealed = (AESSealedSession*)request->payload.ticketEncDec.ticket;
+    bool encrypt = request->header.operation == usTinyAESOp_EncryptWithSessionTicket;
+    struct AES_ctx ctx;
+    usTinyAESStatus status = usTinyAESOp_Success;
+    uint32_t dataLen;
+    uint32_t sequenceNo;
+    (void)sequenceNo;
+
+    if (payloadLen < AES_TICKET_ENC_DEC_FIXED_SIZE)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return;
+    }
+
+    receivePayload(job, (uint8_t*)&request->payload, AES_TICKET_ENC_DEC_FIXED_SIZE);
+    dataLen = payloadLen - AES_TICKET_ENC_DEC_FIXED_SIZE;
+
+    /* A ticket is bound to its owner */
+    if (sealed->id != receiverID || !unsealSession(&deviceKeys.boot, sealed))
+    {
+        status = usTinyAESOp_InvalidSession;
+    }
+    else if (request->payload.ticketEncDec.length != dataLen)
+    {
+        status = usTinyAESOp_InvalidParam_UnsufficientSize;
+    }
+    else if (dataLen > AES_TICKET_ENC_DEC_MAX_DATA_LEN)
+    {
+        status = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+    }
+    else if ((dataLen % sealed->blockSize) != 0)
+    {
+        status = usTinyAESOp_InvalidParam_UnalignedSize;
+    }
+
+    if (status != usTinyAESOp_Success)
+    {
+        memset(sealed, 0, sizeof(AESSealedSession));
+        discardPayload(job, dataLen);
+        sendError(receiverID, &request->header, status);
+        return;
+    }
+
+    AES_init_ctx_iv(&ctx, sealed->key, sealed->iv);
+
+    receiveAndCipher(job, &ctx, encrypt, request->payload.ticketEncDec.buffer, dataLen);
+
+    /* Updated ticket continues the CBC chaining */
+    sealSession(&deviceKeys.boot, receiverID, (usTinyAESAlg)sealed->alg, sealed->blockSize, &ctx, sealed);
+    memset(&ctx, 0, sizeof(ctx));
+
+    request->header.status = usTinyAESOp_Success;
+    request->header.length = AES_PACKAGE_TICKET_ENC_DEC_SIZE(dataLen);
+    (void)Sys_SendMessage(receiverID, (uint8_t*)request, request->header.length, &sequenceNo);
+}
+#endif
+
+/*
+ * Checks the item list of a batch request before executing any item, so a
+ * malformed batch does not leave half executed items (e.g. opened sessions)
+ */
+PRIVATE bool isValidBatch(usTinyAESPayloadBatch* batch, uint32_t itemsLen)
+{
+    usTinyAESBatchItemHead* itemHead;
+    uint32_t offset = 0;
+    uint32_t i;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        if (itemsLen - offset < AES_BATCH_ITEM_HEAD_SIZE)
+        {
+            return false;
+        }
+
+        itemHead = (usTinyAESBatchItemHead*)&batch->items[offset];
+        offset += AES_BATCH_ITEM_HEAD_SIZE;
+
+        /* Items must be word aligned */
+        if (itemHead->length > itemsLen - offset ||
+            (itemHead->length % sizeof(uint32_t)) != 0)
+        {
+            return false;
+        }
+
+        offset += itemHead->length;
+    }
+
+    return true;
+}
+
+/*
+ * Executes the items of a batch request in order.
+ *
+ * Results are written over the request items; a result is never longer than
+ * its item so results never overwrite a not executed item.
+ */
+PRIVATE void processBatch(uint8_t receiverID, usTinyAESRequestPackage* request, uint32_t payloadLen)
+{
+    usTinyAESPayloadBatch* batch = &request->payload.batch;
+    uint32_t itemsLen;
+    uint32_t readOffset = 0;
+    uint32_t writeOffset = 0;
+    uint32_t lastSessionID = AES_SESSION_ID_NOT_ACTIVE;
+    uint32_t i;
+
+    if (payloadLen < AES_BATCH_FIXED_SIZE)
+    {
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return;
+    }
+
+    itemsLen = payloadLen - AES_BATCH_FIXED_SIZE;
+    if (!isValidBatch(batch, itemsLen))
+    {
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return;
+    }
+
+    for (i = 0; i < batch->count; i++)
+    {
+        usTinyAESBatchItemHead itemHead = *(usTinyAESBatchItemHead*)&batch->items[readOffset];
+        uint8_t* itemPayload = &batch->items[readOffset + AES_BATCH_ITEM_HEAD_SIZE];
+        usTinyAESBatchResultHead* result = (usTinyAESBatchResultHead*)&batch->items[writeOffset];
+        uint8_t* output = &batch->items[writeOffset + AES_BATCH_RESULT_HEAD_SIZE];
+        usTinyAESStatus status;
+        uint32_t outputLen = 0;
+        uint32_t sessionID;
+
+        readOffset += AES_BATCH_ITEM_HEAD_SIZE + itemHead.length;
+
+        switch (itemHead.operation)
+        {
+            case usTinyAESOp_OpenSession:
+                if (itemHead.length < sizeof(usTinyAESPayloadOpenSession))
+                {
+                    status = usTinyAESOp_InvalidParam_UnsufficientSize;
+                    break;
+                }
+
+                status = openSession(receiverID, (usTinyAESPayloadOpenSession*)itemPayload, NULL, &sessionID);
+                if (status == usTinyAESOp_Success)
+                {
+                    lastSessionID = sessionID;
+                    memcpy(output, &sessionID, sizeof(sessionID));
+                    outputLen = sizeof(sessionID);
+                }
+                break;
+            case usTinyAESOp_OpenSessionWithKey:
+                if (itemHead.length < sizeof(usTinyAESPayloadOpenSessionWithKey))
+                {
+                    status = usTinyAESOp_InvalidParam_UnsufficientSize;
+                    break;
+                }
+
+                status = openSession(receiverID, NULL, (usTinyAESPayloadOpenSessionWithKey*)itemPayload, &sessionID);
+                if (status == usTinyAESOp_Success)
+                {
+                    lastSessionID = sessionID;
+                    memcpy(output, &sessionID, sizeof(sessionID));
+                    outputLen = sizeof(sessionID);
+                }
+                break;
+            case usTinyAESOp_CloseSession:
+                if (itemHead.length < sizeof(usTinyAESPayloadCloseSession))
+                {
+                    status = usTinyAESOp_InvalidParam_UnsufficientSize;
+                    break;
+                }
+
+                sessionID = ((usTinyAESPayloadCloseSession*)itemPayload)->sessionID;
+                if (sessionID == US_TINYAES_BATCH_LAST_SESSION)
+                {
+                    sessionID = lastSessionID;
+                }
+
+                status = closeSession(receiverID, sessionID);
+                break;
+            case usTinyAESOp_Encrypt:
+            case usTinyAESOp_Decrypt:
+                {
+                    usTinyAESPayloadEncDec* encDec = (usTinyAESPayloadEncDec*)itemPayload;
+                    AESSession* session;
+                    uint32_t ivLen;
+                    uint32_t dataLen;
+
+                    if (itemHead.length < AES_ENC_DEC_FIXED_SIZE)
+                    {
+                        status = usTinyAESOp_InvalidParam_UnsufficientSize;
+                        break;
+                    }
+
+                    ivLen = (encDec->flags & AES_ENC_DEC_FLAG_IV) ? MAX_IV_SIZE : 0;
+                    if (itemHead.length - AES_ENC_DEC_FIXED_SIZE < ivLen)
+                    {
+                        status = usTinyAESOp_InvalidParam_UnsufficientSize;
+                        break;
+                    }
+
+                    sessionID = encDec->sessionID;
+                    if (sessionID == US_TINYAES_BATCH_LAST_SESSION)
+                    {
+                        sessionID = lastSessionID;
+                    }
+
+                    dataLen = itemHead.length - AES_ENC_DEC_FIXED_SIZE - ivLen;
+                    status = getEncDecSession(receiverID, sessionID, encDec->length, dataLen, &session);
+                    if (status == usTinyAESOp_Success)
+                    {
+                        if (ivLen > 0)
+                        {
+                            AES_ctx_set_iv(&session->ctx, encDec->buffer);
+                        }
+
+                        cipher(&session->ctx, itemHead.operation == usTinyAESOp_Encrypt, &encDec->buffer[ivLen], dataLen);
+                        memmove(output, &encDec->buffer[ivLen], dataLen);
+                        outputLen = dataLen;
+                    }
+                }
+                break;
+            default:
+                status = usTinyAESOp_InvalidOperation;
+                break;
+        }
+
+        result->status = (int16_t)status;
+        result->length = (uint16_t)outputLen;
+
+        writeOffset += AES_BATCH_RESULT_HEAD_SIZE + outputLen;
+    }
+
+    /* Send the response */
+    {
+        uint32_t sequenceNo;
+        (void)sequenceNo;
+
+        request->header.status = usTinyAESOp_Success;
+        request->header.length = AES_PACKAGE_HEAD_SIZE + AES_BATCH_FIXED_SIZE + writeOffset;
+        (void)Sys_SendMessage(receiverID, (uint8_t*)request, request->header.length, &sequenceNo);
+    }
+}
+
+/*
+ * Payload length of the operations with a fixed length payload
+ *
+ * @return Payload length; 0 for the operations with a variable length payload
+ */
+PRIVATE ALWAYS_INLINE uint32_t getFixedPayloadLen(int16_t operation)
+{
+    switch (operation)
+    {
+        case usTinyAESOp_OpenSession:
+            return sizeof(usTinyAESPayloadOpenSession);
+        case usTinyAESOp_OpenSessionWithKey:
+            return sizeof(usTinyAESPayloadOpenSessionWithKey);
+        case usTinyAESOp_OpenSessionTicket:
+            return sizeof(usTinyAESPayloadOpenSession);
+        case usTinyAESOp_CloseSession:
+            return sizeof(usTinyAESPayloadCloseSession);
+        case usTinyAESOp_SetIV:
+            return sizeof(usTinyAESPayloadSetIV);
+        case usTinyAESOp_SetSessionPriority:
+            return sizeof(usTinyAESPayloadSetSessionPriority);
+        case usTinyAESOp_ImportKey:
+            return sizeof(usTinyAESPayloadImportKey);
+        case usTinyAESOp_ReleaseKey:
+            return sizeof(usTinyAESPayloadReleaseKey);
+        case usTinyAESOp_StoreKey:
+            return sizeof(usTinyAESPayloadImportKey);
+        case usTinyAESOp_DeleteKey:
+            return sizeof(usTinyAESPayloadReleaseKey);
+        case usTinyAESOp_DeriveKey:
+            return sizeof(usTinyAESPayloadDeriveKey);
+        default:
+            return 0;
+    }
+}
+
+PRIVATE void processRequest(AESJob* job)
+{
+    uint8_t receiverID = job->senderID;
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t payloadLen = job->payloadLen;
+    usTinyAESStatus status;
+    uint32_t fixedPayloadLen;
+
+    /* Encryption/Decryption payload is received while processing */
+    if (request->header.operation == usTinyAESOp_Encrypt ||
+        request->header.operation == usTinyAESOp_Decrypt)
+    {
+        processEncDec(job);
+        return;
+    }
+
+    if (request->header.operation == usTinyAESOp_EncryptOneShot ||
+        request->header.operation == usTinyAESOp_DecryptOneShot ||
+        request->header.operation == usTinyAESOp_EncryptOneShotWithKey ||
+        request->header.operation == usTinyAESOp_DecryptOneShotWithKey)
+    {
+        processOneShot(job);
+        return;
+    }
+
+#if CFG_US_TINYAES_SESSION_TICKETS
+    if (request->header.operation == usTinyAESOp_EncryptWithSessionTicket ||
+        request->header.operation == usTinyAESOp_DecryptWithSessionTicket)
+    {
+        processTicketEncDec(job);
+        return;
+    }
+#endif
+
+    fixedPayloadLen = getFixedPayloadLen(request->header.operation);
+    if (fixedPayloadLen != 0 && payloadLen != fixedPayloadLen)
+    {
+        discardPayload(job, payloadLen);
+        sendError(receiverID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        return;
+    }
+
+    receivePayload(job, (uint8_t*)&request->payload, payloadLen);
+
+    switch (request->header.operation)
+    {
+        case usTinyAESOp_OpenSession:
+        case usTinyAESOp_OpenSessionWithKey:
+            {
+                uint32_t sessionID;
+
+                if (request->header.operation == usTinyAESOp_OpenSession)
+                {
+                    status = openSession(receiverID, &request->payload.openSession, NULL, &sessionID);
+                }
+                else
+                {
+                    status = openSession(receiverID, NULL, &request->payload.openSessionWithKey, &sessionID);
+                }
+
+                if (status != usTinyAESOp_Success)
+                {
+                    sendError(receiverID, &request->header, status);
+                    return;
+                }
+
+                sendHandle(receiverID, &request->header, sessionID);
+            }
+            break;
+        case usTinyAESOp_CloseSession:
+            status = closeSession(receiverID, request->payload.closeSession.sessionID);
+            sendError(receiverID, &request->header, status);
+            break;
+        case usTinyAESOp_ImportKey:
+            {
+                uint32_t keyHandle;
+
+                status = importKey(receiverID, &request->payload.importKey, &keyHandle);
+
+                /* Do not leave the raw key in the request buffer */
+                memset(&request->payload.importKey, 0, sizeof(request->payload.importKey));
+
+                if (status != usTinyAESOp_Success)
+                {
+                    sendError(receiverID, &request->header, status);
+                    return;
+                }
+
+                sendHandle(receiverID, &request->header, keyHandle);
+            }
+            break;
+        case usTinyAESOp_SetIV:
+            status = setIV(receiverID, &request->payload.setIV);
+            sendError(receiverID, &request->header, status);
+            break;
+        case usTinyAESOp_SetSessionPriority:
+            status = setSessionPriority(receiverID, &request->payload.setSessionPriority);
+            sendError(receiverID, &request->header, status);
+            break;
+        case usTinyAESOp_ReleaseKey:
+            status = releaseKeyHandle(receiverID, request->payload.releaseKey.keyHandle);
+            sendError(receiverID, &request->header, status);
+            break;
+        case usTinyAESOp_Batch:
+            processBatch(receiverID, request, payloadLen);
+            break;
+#if CFG_US_TINYAES_SESSION_TICKETS
+        case usTinyAESOp_OpenSessionTicket:
+            openSessionTicket(receiverID, request);
+            break;
+#endif
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+        case usTinyAESOp_StoreKey:
+            {
+                uint32_t keyID;
+
+                status = storeKey(receiverID, job->senderName, &request->payload.importKey, &keyID);
+
+                /* Do not leave the raw key in the request buffer */
+                memset(&request->payload.importKey, 0, sizeof(request->payload.importKey));
+
+                if (status != usTinyAESOp_Success)
+                {
+                    sendError(receiverID, &request->header, status);
+                    return;
+                }
+
+                sendHandle(receiverID, &request->header, keyID);
+            }
+            break;
+        case usTinyAESOp_DeleteKey:
+            status = deleteKey(receiverID, request->payload.releaseKey.keyHandle);
+            sendError(receiverID, &request->header, status);
+            break;
+#endif
+#if CFG_US_TINYAES_KEY_DERIVATION
+        case usTinyAESOp_DeriveKey:
+            {
+                uint32_t keyHandle;
+
+#if AES_USE_SENDER_NAME
+                status = deriveKeyHandle(receiverID, job->senderName, &request->payload.deriveKey, &keyHandle);
+#else
+                status = deriveKeyHandle(receiverID, NULL, &request->payload.deriveKey, &keyHandle);
+#endif
+                if (status != usTinyAESOp_Success)
+                {
+                    sendError(receiverID, &request->header, status);
+                    return;
+                }
+
+                sendHandle(receiverID, &request->header, keyHandle);
+            }
+            break;
+#endif
+        default:
+            sendError(receiverID, &request->header, usTinyAESOp_InvalidOperation);
+            break;
+    }
+}
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+/*
+ * Cost of a job in the Fair Queueing; the header counts so that requests
+ * without a payload are not free
+ */
+#define AES_JOB_COST(_job)                  (AES_PACKAGE_HEAD_SIZE + (_job)->payloadLen)
+
+/*
+ * Gets the priority of a session for the lane of its request; the session is
+ * not restored if spilled. A request of an unknown session fails anyway, so
+ * it gets the default.
+ */
+PRIVATE uint8_t getSessionPriority(uint8_t receiverID, uint32_t sessionID)
+{
+    uint8_t priority = usTinyAESPriority_Default;
+    uint32_t i;
+
+    if (AES_HANDLE_GET_OWNER(sessionID) != receiverID)
+    {
+        return priority;
+    }
+
+    AES_ENTER_CRITICAL_SECTION();
+
+    /* A restored session may be in any slot */
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SESSION; i++)
+    {
+        if (sessionTable.slots[i].id == sessionID)
+        {
+            priority = sessionTable.slots[i].priority;
+            break;
+        }
+    }
+
+#if CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION > 0
+    for (i = 0; i < CFG_US_TINYAES_MAX_NUM_OF_SPILLED_SESSION; i++)
+    {
+        if (sessionTable.spilled[i].id == sessionID)
+        {
+            priority = sessionTable.spilled[i].priority;
+            break;
+        }
+    }
+#endif
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    return priority;
+}
+
+/*
+ * Gets the lane of a job by the priority of its session. Session/Key
+ * management goes to the control lane by default, and small requests skip
+ * ahead of the large ones in the express lane; but not ahead of the requests
+ * in flight on the same session, see dispatchJob(). The payload is already
+ * received, so the session ID is at hand.
+ */
+PRIVATE ALWAYS_INLINE uint8_t getLane(AESJob* job)
+{
+    usTinyAESRequestPackage* request = &job->package;
+    uint8_t priority = usTinyAESPriority_Default;
+
+    /* The session ID is the first payload field of the session requests */
+    switch (request->header.operation)
+    {
+        case usTinyAESOp_Encrypt:
+        case usTinyAESOp_Decrypt:
+        case usTinyAESOp_SetIV:
+        case usTinyAESOp_CloseSession:
+            if (job->payloadLen >= sizeof(uint32_t))
+            {
+                priority = getSessionPriority(job->senderID, request->payload.closeSession.sessionID);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    switch (priority)
+    {
+        case usTinyAESPriority_Control:
+            return AESLane_Control;
+
+        case usTinyAESPriority_Default:
+            if (getFixedPayloadLen(request->header.operation) != 0)
+            {
+                return AESLane_Control;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    if (job->payloadLen <= CFG_US_TINYAES_EXPRESS_MAX_LEN)
+    {
+        return AESLane_Express;
+    }
+
+    return priority == usTinyAESPriority_Bulk ? AESLane_Bulk : AESLane_Interactive;
+}
+
+/*
+ * Takes the next job of a lane by Deficit Round Robin. The flow at the head
+ * is served while its deficit covers its next job; otherwise it is given its
+ * quantum and moved to the tail. Must be called in the critical section.
+ */
+PRIVATE AESJob* nextJob(AESFlowQueue* lane)
+{
+    AESFlow* flow;
+    AESJob* job;
+
+    while (1)
+    {
+        flow = lane->head;
+        if (flow == NULL)
+        {
+            return NULL;
+        }
+
+        job = flow->head;
+        if (flow->deficit >= AES_JOB_COST(job))
+        {
+            break;
+        }
+
+        flow->deficit += CFG_US_TINYAES_FAIR_QUANTUM * CFG_US_TINYAES_FAIR_WEIGHT(flow->senderID);
+
+        if (flow->next != NULL)
+        {
+            lane->head = flow->next;
+            lane->tail->next = flow;
+            lane->tail = flow;
+            flow->next = NULL;
+        }
+    }
+
+    flow->deficit -= AES_JOB_COST(job);
+
+    flow->head = job->next;
+    job->next = NULL;
+
+    /* An idle flow keeps no credit; it is released until its next job */
+    if (flow->head == NULL)
+    {
+        lane->head = flow->next;
+        if (lane->head == NULL)
+        {
+            lane->tail = NULL;
+        }
+
+        flow->next = flowPool.freeList;
+        flowPool.freeList = flow;
+    }
+
+    return job;
+}
+
+/*
+ * Executes the jobs dispatched to the worker
+ */
+PRIVATE void workerThread(void* args)
+{
+    AESWorker* worker = (AESWorker*)args;
+    AESJob* job;
+    uint32_t lane;
+
+    while (1)
+    {
+        (void)Sys_WaitSemaphore(worker->semaphoreID);
+
+        AES_ENTER_CRITICAL_SECTION();
+        for (lane = 0, job = NULL; lane < AESLane_Count && job == NULL; lane++)
+        {
+            job = nextJob(&worker->lanes[lane]);
+        }
+        AES_EXIT_CRITICAL_SECTION();
+
+        if (job == NULL)
+        {
+            continue;
+        }
+
+        /* The job may have expired while waiting in the queue */
+        if (isExpired(&job->package))
+        {
+            sendError(job->senderID, &job->package.header, usTinyAESOp_Timeout);
+        }
+        else
+        {
+            processRequest(job);
+        }
+
+        releaseJob(job);
+    }
+}
+
+/*
+ * Marks a session slot the job refers to; handles of other owners and of keys
+ * fail anyway, so they are not ordered
+ */
+PRIVATE ALWAYS_INLINE void markSessionSlot(AESJob* job, uint32_t sessionID)
+{
+    uint32_t slot = AES_HANDLE_GET_SLOT(sessionID);
+
+    if ((sessionID & AES_HANDLE_TYPE_KEY) == 0 &&
+        AES_HANDLE_GET_OWNER(sessionID) == job->senderID &&
+        slot < CFG_US_TINYAES_MAX_NUM_OF_SESSION)
+    {
+        job->sessionSlots[slot / 8] |= (uint8_t)(1 << (slot % 8));
+    }
+}
+
+/*
+ * Marks the session slots a batch refers to; the sessions opened by the batch
+ * itself (US_TINYAES_BATCH_LAST_SESSION) are not known to anybody else yet
+ */
+PRIVATE void markBatchSessionSlots(AESJob* job)
+{
+    usTinyAESPayloadBatch* batch = &job->package.payload.batch;
+    usTinyAESBatchItemHead* itemHead;
+    uint32_t itemsLen;
+    uint32_t offset = 0;
+    uint32_t i;
+
+    /* A malformed batch is rejected by the worker */
+    if (job->payloadLen < AES_BATCH_FIXED_SIZE)
+    {
+        return;
+    }
+
+    itemsLen = job->payloadLen - AES_BATCH_FIXED_SIZE;
+    if (!isValidBatch(batch, itemsLen))
+    {
+        return;
+    }
+
+    for (i = 0; i < batch->count; i++)
+    {
+        itemHead = (usTinyAESBatchItemHead*)&batch->items[offset];
+        offset += AES_BATCH_ITEM_HEAD_SIZE;
+
+        switch (itemHead->operation)
+        {
+            /* The session ID is the first field of these items */
+            case usTinyAESOp_CloseSession:
+            case usTinyAESOp_Encrypt:
+            case usTinyAESOp_Decrypt:
+                if (itemHead->length >= sizeof(uint32_t))
+                {
+                    markSessionSlot(job, *(uint32_t*)&batch->items[offset]);
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        offset += itemHead->length;
+    }
+}
+
+/*
+ * Gets the worker and lane of the jobs in flight on the session slots of a
+ * job. Must be called in the critical section.
+ *
+ * @return false if the slots are in flight on different workers or lanes
+ */
+PRIVATE bool getSessionOrder(AESJob* job, uint32_t* workerIndex, uint32_t* laneIndex)
+{
+    bool found = false;
+    uint32_t slot;
+
+    for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_SESSION; slot++)
+    {
+        if ((job->sessionSlots[slot / 8] & (1 << (slot % 8))) == 0 ||
+            sessionOrder[slot].pending == 0)
+        {
+            continue;
+        }
+
+        if (found &&
+            (sessionOrder[slot].worker != *workerIndex || sessionOrder[slot].lane != *laneIndex))
+        {
+            return false;
+        }
+
+        *workerIndex = sessionOrder[slot].worker;
+        *laneIndex = sessionOrder[slot].lane;
+        found = true;
+    }
+
+    return true;
+}
+
+/*
+ * Queues a job to a worker. The requests on a session are sharded by the slot
+ * of its handle, and the others by the requester ID which is also the owner ID
+ * of the key handles. While a session has jobs in flight, the later jobs
+ * referring to it, a batch included, are queued to the same worker and lane
+ * whatever their own lane is, so a session is only accessed by one worker at a
+ * time and its requests are never reordered. A batch referring to sessions in
+ * flight on different workers or lanes waits until they are done.
+ *
+ * Each requester has its own flow in each lane of the worker, so requests of
+ * an owner are processed in order within a lane. A flow with a new job joins
+ * the round earliest deadline first with the quantum of its requester; a job
+ * without a deadline is aged, see CFG_US_TINYAES_NO_DEADLINE_AGING_MS.
+ */
+PRIVATE void dispatchJob(AESJob* job)
+{
+    usTinyAESRequestPackage* request = &job->package;
+    uint32_t workerIndex = job->senderID % CFG_US_TINYAES_NUM_OF_WORKERS;
+    AESWorker* worker;
+    AESFlowQueue* lane;
+    AESFlow* flow;
+    AESFlow** link;
+    uint32_t laneIndex;
+    uint32_t slot;
+
+    job->next = NULL;
+
+    switch (request->header.operation)
+    {
+        /* The session ID is the first payload field of the session requests */
+        case usTinyAESOp_Encrypt:
+        case usTinyAESOp_Decrypt:
+        case usTinyAESOp_SetIV:
+        case usTinyAESOp_CloseSession:
+        case usTinyAESOp_SetSessionPriority:
+            if (job->payloadLen >= sizeof(uint32_t))
+            {
+                markSessionSlot(job, request->payload.closeSession.sessionID);
+                workerIndex = AES_HANDLE_GET_SLOT(request->payload.closeSession.sessionID) % CFG_US_TINYAES_NUM_OF_WORKERS;
+            }
+            break;
+
+        case usTinyAESOp_Batch:
+            markBatchSessionSlots(job);
+            break;
+
+        default:
+            break;
+    }
+
+    laneIndex = getLane(job);
+
+    setOrderDeadline(job);
+
+    /* Retried whenever a job is released */
+    while (1)
+    {
+        AES_ENTER_CRITICAL_SECTION();
+
+        if (getSessionOrder(job, &workerIndex, &laneIndex))
+        {
+            break;
+        }
+
+        jobPool.dispatcherWaiting = true;
+
+        AES_EXIT_CRITICAL_SECTION();
+
+        (void)Sys_WaitSemaphore(jobPool.semaphoreID);
+    }
+
+    for (slot = 0; slot < CFG_US_TINYAES_MAX_NUM_OF_SESSION; slot++)
+    {
+        if (job->sessionSlots[slot / 8] & (1 << (slot % 8)))
+        {
+            sessionOrder[slot].pending++;
+            sessionOrder[slot].worker = (uint8_t)workerIndex;
+            sessionOrder[slot].lane = (uint8_t)laneIndex;
+        }
+    }
+
+    worker = &workers[workerIndex];
+    lane = &worker->lanes[laneIndex];
+
+    job->dispatched = true;
+
+    for (flow = lane->head; flow != NULL; flow = flow->next)
+    {
+        if (flow->senderID == job->senderID)
+        {
+            break;
+        }
+    }
+
+    if (flow != NULL)
+    {
+        flow->tail->next = job;
+        flow->tail = job;
+    }
+    else
+    {
+        /* Never empty; see flowPool */
+        flow = flowPool.freeList;
+        flowPool.freeList = flow->next;
+
+        flow->head = job;
+        flow->tail = job;
+        flow->senderID = job->senderID;
+        flow->deficit = CFG_US_TINYAES_FAIR_QUANTUM * CFG_US_TINYAES_FAIR_WEIGHT(job->senderID);
+
+        for (link = &lane->head; *link != NULL; link = &(*link)->next)
+        {
+            if (AES_DEADLINE_BEFORE(job->orderDeadline, (*link)->head->orderDeadline))
+            {
+                break;
+            }
+        }
+
+        flow->next = *link;
+        *link = flow;
+        if (flow->next == NULL)
+        {
+            lane->tail = flow;
+        }
+    }
+
+    AES_EXIT_CRITICAL_SECTION();
+
+    (void)Sys_ReleaseSemaphore(worker->semaphoreID);
+}
+
+PRIVATE SysStatus startWorkers(void)
+{
+    SysStatus retVal;
+    uint32_t i;
+    uint32_t lane;
+
+    SYS_INITIALISE_THREAD_POOL(retVal, CFG_US_TINYAES_NUM_OF_WORKERS);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    /* A semaphore per worker and one for the job pool */
+    SYS_INITIALISE_THREADSYNC_POOL(retVal, CFG_US_TINYAES_NUM_OF_WORKERS + 1);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    retVal = Sys_GetSemaphore(1, &jobPool.semaphoreID);
+    if (retVal != SysStatus_Success)
+    {
+        return retVal;
+    }
+
+    /* Not fatal; lanes still order the queues, only the dispatch may be delayed */
+    retVal = Sys_SetMainThreadPriority(CFG_US_TINYAES_DISPATCHER_PRIORITY);
+    if (retVal != SysStatus_Success)
+    {
+        LOG_WARNING("Dispatcher Priority cannot be set! %d", retVal);
+    }
+
+    flowPool.freeList = NULL;
+    for (i = 0; i < CFG_US_TINYAES_NUM_OF_JOBS; i++)
+    {
+        flowPool.flows[i].next = flowPool.freeList;
+        flowPool.freeList = &flowPool.flows[i];
+    }
+
+    for (i = 0; i < CFG_US_TINYAES_NUM_OF_WORKERS; i++)
+    {
+        AESWorker* worker = &workers[i];
+
+        for (lane = 0; lane < AESLane_Count; lane++)
+        {
+            worker->lanes[lane].head = NULL;
+            worker->lanes[lane].tail = NULL;
+        }
+
+        retVal = Sys_GetSemaphore(CFG_US_TINYAES_NUM_OF_JOBS, &worker->semaphoreID);
+        if (retVal != SysStatus_Success)
+        {
+            return retVal;
+        }
+
+        retVal = Sys_GetThread(workerThread,
+                               (uint8_t*)worker->stack, sizeof(worker->stack),
+                               CFG_US_TINYAES_WORKER_PRIORITY,
+                               worker, &worker->threadID);
+        if (retVal != SysStatus_Success)
+        {
+            return retVal;
+        }
 
-PRIVATE void startAESService(void);
+        retVal = Sys_ResumeThread(worker->threadID);
+        if (retVal != SysStatus_Success)
+        {
+            return retVal;
+        }
+    }
 
-/******************************** VARIABLES ***********************************/
+    return SysStatus_Success;
+}
+#endif
 
-PRIVATE AESSession aesSession;
+#if CFG_US_TINYAES_NUM_OF_WORKERS == 0 && CFG_US_TINYAES_SLICE_BLOCKS > 0
+#define AES_SLICE_LEN                       (CFG_US_TINYAES_SLICE_BLOCKS * AES_BLOCKLEN)
 
-PRIVATE usTinyAESRequestPackage aesRequest;
+/*
+ * Checks whether a requester has queued jobs; its new requests are queued
+ * behind them, so the requests of an owner are still processed in order
+ */
+PRIVATE bool hasQueuedJob(uint8_t senderID)
+{
+    AESJob* job;
 
-/**************************** PRIVATE FUNCTIONS ******************************/
+    for (job = sliceQueue.head; job != NULL; job = job->next)
+    {
+        if (job->senderID == senderID)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
 
-PRIVATE ALWAYS_INLINE void sendError(uint8_t receiverID, uint16_t operation, uint8_t status)
+/*
+ * Checks whether a job is to be processed in slices. The last free request
+ * buffer is not taken, so small requests are still processed while received.
+ */
+PRIVATE ALWAYS_INLINE bool isSliced(AESJob* job)
 {
-    uint32_t sequenceNo;
-    (void)sequenceNo;
-    usTinyAESResponsePackage response = 
-    {
-        .header.operation = operation,
-        .header.status = status
-    };
-    
-    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, sizeof(response), &sequenceNo);
+    return (job->package.header.operation == usTinyAESOp_Encrypt ||
+            job->package.header.operation == usTinyAESOp_Decrypt) &&
+           job->payloadLen > AES_ENC_DEC_FIXED_SIZE + AES_SLICE_LEN &&
+           jobPool.freeList != NULL;
 }
 
-PRIVATE ALWAYS_INLINE uint32_t getSessionID(uint8_t receiverID)
+/*
+ * Receives the whole payload of a job and queues it to be processed in slices
+ */
+PRIVATE void queueJob(AESJob* job)
 {
-    static uint32_t lastValue = 0x00A1B2C3;
-    lastValue = lastValue * lastValue;
-    
-    #define SESSION_ID_RECEIVER_ID_MASK     ((uint32_t)0x000000FF)
-    #define SESSION_ID_RANDOM_MASK          ((uint32_t)(~SESSION_ID_RECEIVER_ID_MASK))
-    
-    return (lastValue & SESSION_ID_RANDOM_MASK) | receiverID;
+    receiveMessage((uint8_t*)&job->package.payload, job->payloadLen);
+    job->buffered = true;
+
+    job->sequence = ++sliceQueue.lastSequence;
+    job->next = NULL;
+
+    setOrderDeadline(job);
+
+    if (sliceQueue.tail != NULL)
+    {
+        sliceQueue.tail->next = job;
+    }
+    else
+    {
+        sliceQueue.head = job;
+    }
+    sliceQueue.tail = job;
 }
 
-PRIVATE ALWAYS_INLINE bool isValidAlgorithm(usTinyAESRequestPackage* request, uint32_t* blockSize)
+/*
+ * Checks whether a queued job is the oldest queued job of its requester
+ */
+PRIVATE bool isRunnable(AESJob* job)
 {
-#if SUPPORT_ONLY_CBC256
-    if (request->payload.openSession.alg != usTinyAESAlg_AES_CBC_256)
+    AESJob* other;
+
+    for (other = sliceQueue.head; other != NULL; other = other->next)
     {
-        return false;
+        if (other->senderID == job->senderID && (int32_t)(other->sequence - job->sequence) < 0)
+        {
+            return false;
+        }
     }
-    
-    *blockSize = MAX_KEY_SIZE;
-    
+
     return true;
-#else
-    #error "Unsupported yet"
-#endif
 }
 
-PRIVATE ALWAYS_INLINE bool isValidKeyAndIV(usTinyAESRequestPackage* request)
+/*
+ * Processes the next slice of a queued job. A queued job other than a sliced
+ * Encryption/Decryption is processed at once.
+ *
+ * The session is looked up again on every slice, so a job of a session closed
+ * meanwhile fails instead of using a reallocated session slot.
+ *
+ * @return true if the job has more slices
+ */
+PRIVATE bool processSlice(AESJob* job)
 {
-#if SUPPORT_ONLY_CBC256    
-    if (request->payload.openSession.keyLen != MAX_KEY_SIZE ||
-        request->payload.openSession.ivLen != MAX_IV_SIZE)
+    usTinyAESRequestPackage* request = &job->package;
+    AESSession* session;
+    usTinyAESStatus status;
+    uint32_t len;
+
+    if (!job->started)
     {
-        return false;
+        job->started = true;
+
+        if (isExpired(request))
+        {
+            sendError(job->senderID, &request->header, usTinyAESOp_Timeout);
+            return false;
+        }
+
+        if (request->header.operation != usTinyAESOp_Encrypt &&
+            request->header.operation != usTinyAESOp_Decrypt)
+        {
+            processRequest(job);
+            return false;
+        }
+
+        if (!startEncDec(job, &session, &job->dataLen))
+        {
+            return false;
+        }
+
+        /* Get the data to the beginning of the buffer */
+        receivePayload(job, request->payload.encDec.buffer, job->dataLen);
+        job->dataOffset = 0;
     }
-    return true;
-#else
-    #error "Unsupported yet"
+    else
+    {
+        status = getSession(job->senderID, request->payload.encDec.sessionID, &session);
+        if (status != usTinyAESOp_Success)
+        {
+            sendError(job->senderID, &request->header, status);
+            return false;
+        }
+    }
+
+    len = (job->dataLen - job->dataOffset) < AES_SLICE_LEN ? (job->dataLen - job->dataOffset) : AES_SLICE_LEN;
+
+    cipher(&session->ctx, request->header.operation == usTinyAESOp_Encrypt, &request->payload.encDec.buffer[job->dataOffset], len);
+    job->dataOffset += len;
+
+    if (job->dataOffset < job->dataLen)
+    {
+        return true;
+    }
+
+    sendEncDec(job, job->dataLen);
+
+    return false;
+}
+
+/*
+ * Processes a slice of the runnable queued job with the earliest deadline,
+ * round robin among the equal ones. Jobs of different requesters are
+ * interleaved; the jobs of a requester are processed one after the other in
+ * order.
+ */
+PRIVATE void runSlice(void)
+{
+    AESJob** link;
+    AESJob* job = NULL;
+    AESJob* previous = NULL;
+    AESJob* other = NULL;
+
+    for (link = &sliceQueue.head; *link != NULL; other = *link, link = &(*link)->next)
+    {
+        if (isRunnable(*link) &&
+            (job == NULL || AES_DEADLINE_BEFORE((*link)->orderDeadline, job->orderDeadline)))
+        {
+            job = *link;
+            previous = other;
+        }
+    }
+
+    if (job == NULL)
+    {
+        return;
+    }
+
+    link = (previous != NULL) ? &previous->next : &sliceQueue.head;
+
+    /* Unlink while processing; the job is not its own predecessor for isRunnable() */
+    *link = job->next;
+    if (sliceQueue.tail == job)
+    {
+        sliceQueue.tail = previous;
+    }
+    job->next = NULL;
+
+    if (!processSlice(job))
+    {
+        releaseJob(job);
+        return;
+    }
+
+    /* Round robin; the other jobs of the same deadline get their slice before the next one */
+    if (sliceQueue.tail != NULL)
+    {
+        sliceQueue.tail->next = job;
+    }
+    else
+    {
+        sliceQueue.head = job;
+    }
+    sliceQueue.tail = job;
+}
 #endif
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0 && CFG_US_TINYAES_BUSY_THRESHOLD > 0
+/*
+ * Rejects the current message while the request buffer pool is empty, so the
+ * message box is drained even when the workers are behind
+ */
+PRIVATE void rejectMessage(uint32_t receivedLen)
+{
+    struct
+    {
+        uServicePackageHeader header;
+        uint32_t deadline;
+    } head;
+    uint32_t len = receivedLen < sizeof(head) ? receivedLen : sizeof(head);
+    uint32_t sequenceNo;
+    uint8_t senderID;
+    (void)sequenceNo;
+
+    memset(&head, 0, sizeof(head));
+    (void)Sys_ReceiveMessage(&senderID, (uint8_t*)&head, len, &sequenceNo);
+    discardMessage(receivedLen - len);
+
+    sendBusy(senderID, &head.header);
 }
+#endif
 
-PRIVATE ALWAYS_INLINE void processRequest(uint8_t receiverID, usTinyAESRequestPackage* request)
+/*
+ * Receives a single message of the given length into the job and processes it
+ * or dispatches it to a worker. The job is released when its response is sent.
+ */
+PRIVATE void processMessage(AESJob* job, uint32_t receivedLen)
 {
-    usTinyAESResponsePackage response;
+    usTinyAESRequestPackage* request = &job->package;
+    usTinyAESStatus responseStatus;
+    uint32_t sequenceNo;
+    (void)sequenceNo;
 
-    switch (aesRequest.header.operation)
+    if (receivedLen <= AES_PACKAGE_HEAD_SIZE)
     {
-        case usTinyAESOp_OpenSession:
-            {
-                uint32_t blockSize;
+        responseStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
+        LOG_PRINTF(" > Unsufficint Mandatory Received Length (%d)/(%d)",
+                   receivedLen, AES_PACKAGE_HEAD_SIZE);
 
-                if (aesSession.id != AES_SESSION_ID_NOT_ACTIVE)
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_NoSessionSlotAvailable);
-                    return;
-                }
+        /* Let us just get whatever received; the rest of the header is not echoed back */
+        memset(&request->header, 0, USERVICE_PACKAGE_HEADER_SIZE);
+        (void)Sys_ReceiveMessage(&job->senderID, (uint8_t*)request, receivedLen, &sequenceNo);
+        sendError(job->senderID, &request->header, responseStatus);
+        releaseJob(job);
+        return;
+    }
 
-                if (!isValidAlgorithm(request, &blockSize))
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_UnsupportedOperation);
-                    return;
-                }
+    /* Get the header and the deadline; the payload is received depending on the operation */
+#if AES_USE_SENDER_NAME
+    (void)Sys_ReceiveMessage(&job->senderID, (uint8_t*)request, USERVICE_PACKAGE_HEADER_SIZE, &sequenceNo);
 
-                if (!isValidKeyAndIV(request))
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_InvalidParam_Key);
-                    return;
-                }
+    /* The Execution Name of the sender is only needed to bind a stored or a derived key */
+    if (request->header.operation == usTinyAESOp_StoreKey || request->header.operation == usTinyAESOp_DeriveKey)
+    {
+        memset(job->senderName, 0, sizeof(job->senderName));
+        (void)Sys_ReceiveMessageByName(job->senderName, (uint8_t*)&request->deadline, sizeof(request->deadline), &sequenceNo);
+    }
+    else
+    {
+        receiveMessage((uint8_t*)&request->deadline, sizeof(request->deadline));
+    }
+#else
+    (void)Sys_ReceiveMessage(&job->senderID, (uint8_t*)request, AES_PACKAGE_HEAD_SIZE, &sequenceNo);
+#endif
 
-                /* Initialise the AES Context */
-                AES_init_ctx_iv(&aesSession.ctx, request->payload.openSession.key, request->payload.openSession.iv);
-                
-                aesSession.id = getSessionID(receiverID);
-                aesSession.blockSize = blockSize;
+    /* Framing; the header must tell the actual message length */
+    if (request->header.length != receivedLen)
+    {
+        LOG_PRINTF(" > Header Length (%d) mismatch with Received Length (%d)",
+                   request->header.length, receivedLen);
 
-                /* Send the response */
-                {
-                    uint32_t sequenceNo;
-                    (void)sequenceNo;
+        discardMessage(receivedLen - AES_PACKAGE_HEAD_SIZE);
+        sendError(job->senderID, &request->header, usTinyAESOp_InvalidParam_UnsufficientSize);
+        releaseJob(job);
+        return;
+    }
 
-                    response.header.operation = request->header.operation;
-                    response.header.status = usTinyAESOp_Success;
-                    response.payload.openSession.sessionID = aesSession.id;
-                    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, sizeof(usTinyAESResponsePackage), &sequenceNo);
-                }
-            }
-            break;
-        case usTinyAESOp_CloseSession:
-            {
-                uint8_t ownerID;
-                ownerID = request->payload.closeSession.sessionID & SESSION_ID_RECEIVER_ID_MASK;
-                if (ownerID != receiverID || aesSession.id != request->payload.closeSession.sessionID)
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_InvalidSession);
-                    return;
-                }
+    job->payloadLen = receivedLen - AES_PACKAGE_HEAD_SIZE;
 
-                aesSession.id = AES_SESSION_ID_NOT_ACTIVE;
-                
-                /* Just return success even no session active */
-                sendError(receiverID, request->header.operation, usTinyAESOp_Success);
-                
-            }
-            break;
-        case usTinyAESOp_Encrypt:
-        case usTinyAESOp_Decrypt:
-            {
-                uint8_t ownerID;
-                if (aesSession.id == AES_SESSION_ID_NOT_ACTIVE)
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_NoSession);
-                    return;
-                }
-                
-                ownerID = request->payload.encDec.sessionID & SESSION_ID_RECEIVER_ID_MASK;
-                if (ownerID != receiverID || aesSession.id != request->payload.encDec.sessionID)
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_InvalidSession);
-                    return;
-                }
+    /* The caller has already given up; do not waste cipher time on it */
+    if (isExpired(request))
+    {
+        discardMessage(job->payloadLen);
+        sendError(job->senderID, &request->header, usTinyAESOp_Timeout);
+        releaseJob(job);
+        return;
+    }
 
-                if (request->payload.encDec.length > MAX_BLOCK_SIZE)
-                {
-                    sendError(receiverID, request->header.operation, usTinyAESOp_InvalidParam_SizeExceedAllowed);
-                    return;
-                }
+    if (job->payloadLen > AES_PACKAGE_MAX_SIZE - AES_PACKAGE_HEAD_SIZE)
+    {
+        responseStatus = usTinyAESOp_InvalidParam_SizeExceedAllowed;
 
-                if (request->header.operation == usTinyAESOp_Encrypt)
-                {
-                    AES_CBC_encrypt_buffer(&aesSession.ctx, (uint8_t*)request->payload.encDec.buffer, request->payload.encDec.length);
-                }
-                else
-                {
-                    AES_CBC_decrypt_buffer(&aesSession.ctx, (uint8_t*)request->payload.encDec.buffer, request->payload.encDec.length);
-                }
-                
-                response.payload.encDec.length = aesSession.blockSize;                
-                memcpy(response.payload.encDec.buffer, request->payload.encDec.buffer, aesSession.blockSize);
+        LOG_PRINTF(" > Received Length (%d) exceed than allowed length(%d)",
+                   receivedLen, AES_PACKAGE_MAX_SIZE);
 
-                /* Send the response */
-                {
-                    uint32_t sequenceNo;
-                    (void)sequenceNo;
+        /* Not need for the payload */
+        discardMessage(job->payloadLen);
+        sendError(job->senderID, &request->header, responseStatus);
+        releaseJob(job);
+        return;
+    }
 
-                    response.header.operation = request->header.operation;
-                    response.header.status = usTinyAESOp_Success;
-                    (void)Sys_SendMessage(receiverID, (uint8_t*)&response, sizeof(response), &sequenceNo);
-                }
-            }
-            break;
-        default:
-            sendError(receiverID, aesRequest.header.operation, usTinyAESOp_InvalidOperation);
-            break;
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    /* Before the payload is received; the job is not held for a flooding requester */
+    if (!admitSender(job))
+    {
+        discardMessage(job->payloadLen);
+        sendRetryAfter(job->senderID, &request->header, usTinyAESOp_Busy, CFG_US_TINYAES_BUSY_RETRY_AFTER_MS);
+        releaseJob(job);
+        return;
+    }
+#endif
+
+#if CFG_US_TINYAES_RATE_LIMIT
+    {
+        uint32_t refillMs = limitRate(job);
+
+        if (refillMs > 0)
+        {
+            discardMessage(job->payloadLen);
+            sendRetryAfter(job->senderID, &request->header, usTinyAESOp_Throttled, refillMs);
+            releaseJob(job);
+            return;
+        }
+    }
+#endif
+
+#if AES_USE_ADMISSION
+    if (!admitJob(job))
+    {
+        discardMessage(job->payloadLen);
+        sendBusy(job->senderID, &request->header);
+        releaseJob(job);
+        return;
+    }
+#endif
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    /* Workers cannot receive partially from the shared message box; get the whole payload */
+    receiveMessage((uint8_t*)&request->payload, job->payloadLen);
+    job->buffered = true;
+
+    dispatchJob(job);
+#else
+#if CFG_US_TINYAES_SLICE_BLOCKS > 0
+    if (hasQueuedJob(job->senderID))
+    {
+        /* In order behind the queued jobs, but not in the last free buffer; see isSliced() */
+        if (jobPool.freeList == NULL)
+        {
+            discardMessage(job->payloadLen);
+            sendRetryAfter(job->senderID, &request->header, usTinyAESOp_Busy, CFG_US_TINYAES_BUSY_RETRY_AFTER_MS);
+            releaseJob(job);
+            return;
+        }
+
+        queueJob(job);
+        return;
+    }
+
+    if (isSliced(job))
+    {
+        queueJob(job);
+        return;
     }
+#endif
+
+    /* Process the request while receiving its payload */
+    processRequest(job);
+    releaseJob(job);
+#endif
 }
 
 PRIVATE void startAESService(void)
 {
+    AESJob* job;
     bool dataReceived;
     uint32_t receivedLen;
-    uint8_t senderID;
-    bool responseStatus;
     uint32_t sequenceNo;
     (void)sequenceNo;
 
     while (1)
     {
-        dataReceived = false;
-        receivedLen = 0;
-        responseStatus = usTinyAESOp_Success;
+        /*
+         * Clear the event before draining; a message received during the drain
+         * sets it again, so the wait below does not sleep on a queued message
+         */
+        (void)Sys_ClearPendingEvent(SysEvent_IPCMessage);
 
-        (void)Sys_IsMessageReceived(&dataReceived, &receivedLen, &sequenceNo);       
-        if (!dataReceived || receivedLen == 0)
-        {
-            /* Sleep until receive an IPC message */
-            Sys_WaitForEvent(SysEvent_IPCMessage);
-            
-            continue;
-        }
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+        /* Usage counters are written at most once a save period */
+        AES_ENTER_CRITICAL_SECTION();
+        saveKeyStoreUsage();
+        AES_EXIT_CRITICAL_SECTION();
+#endif
 
-        if (receivedLen <= USERVICE_PACKAGE_HEADER_SIZE)
+#if CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS > 0
+        /*
+         * The timer only sets the flag; it is checked whenever the service
+         * wakes up, and a full table evicts an idle session anyway
+         */
+        if (sessionTable.idleTimerFlag)
         {
-            responseStatus = usTinyAESOp_InvalidParam_UnsufficientSize;
-            LOG_PRINTF(" > Unsufficint Mandatory Received Length (%d)/(%d)",
-                       receivedLen, USERVICE_PACKAGE_HEADER_SIZE);
+            reclaimIdleSessions();
         }
-        
-        if (responseStatus == usTinyAESOp_Success &&
-            receivedLen > AES_PACKAGE_MAX_SIZE)
+#endif
+
+        /* Process every queued message before sleeping again */
+        while (1)
         {
-            responseStatus = usTinyAESOp_InvalidParam_SizeExceedAllowed;
+            dataReceived = false;
+            receivedLen = 0;
 
-            LOG_PRINTF(" > Received Length (%d) exceed than allowed length(%d)",
-                       receivedLen, AES_PACKAGE_MAX_SIZE);
-            
-            /* Let us just get the header, as not need for the payload */
-            receivedLen = USERVICE_PACKAGE_HEADER_SIZE;
-        }
+            (void)Sys_IsMessageReceived(&dataReceived, &receivedLen, &sequenceNo);
+            if (!dataReceived || receivedLen == 0)
+            {
+                break;
+            }
+
+            job = allocateJob();
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0 && CFG_US_TINYAES_BUSY_THRESHOLD > 0
+            if (job == NULL)
+            {
+                rejectMessage(receivedLen);
+                continue;
+            }
+#elif CFG_US_TINYAES_NUM_OF_WORKERS == 0 && CFG_US_TINYAES_SLICE_BLOCKS > 0
+            /* Every buffer is queued; the message waits until a queued job completes */
+            if (job == NULL)
+            {
+                break;
+            }
+#endif
 
-        /* Get the message */
-        (void)Sys_ReceiveMessage(&senderID, (uint8_t*)&aesRequest, receivedLen, &sequenceNo);
+            processMessage(job, receivedLen);
+        }
 
-        /* Do not process the message if there was an error */
-        if (responseStatus != usTinyAESOp_Success)
+#if CFG_US_TINYAES_NUM_OF_WORKERS == 0 && CFG_US_TINYAES_SLICE_BLOCKS > 0
+        /* A slice at a time; new messages are checked again before the next one */
+        if (sliceQueue.head != NULL)
         {
-            sendError(senderID, aesRequest.header.operation, responseStatus);
+            runSlice();
+            Sys_Yield();
             continue;
         }
+#endif
 
-        /* Process the request */
-        processRequest(senderID, &aesRequest);        
+        /* Sleep until receive an IPC message */
+        Sys_WaitForEvent(SysEvent_IPCMessage);
     }
 }
 
@@ -264,15 +4114,75 @@ int main(void)
 
     uService_PrintIntro();
 
-#if CFG_US_TINYAES_MAX_NUM_OF_SESSION == 1
-    SYS_INITIALISE_IPC_MESSAGEBOX(retVal, CFG_US_TINYAES_MAX_NUM_OF_SESSION);
+    initialiseSessionTable();
+    initialiseKeyTable();
+    initialiseJobPool();
+
+    /* Requests of concurrent clients are queued up to the capacity */
+    SYS_INITIALISE_IPC_MESSAGEBOX(retVal, CFG_US_TINYAES_MESSAGEBOX_CAPACITY);
     if (retVal != SysStatus_Success)
     {
         LOG_ERROR("IPC Messagebox Init Fails! %d", retVal);
         Sys_Exit();
     }
-#else
-    #error "Multiple request not supported yet!"
+
+#if AES_USE_CMAC
+    retVal = runSelfTests();
+    if (retVal != SysStatus_Success)
+    {
+        LOG_ERROR("Self Test Fails! %d", retVal);
+        Sys_Exit();
+    }
+#endif
+
+#if AES_USE_DEVICE_KEYS
+    {
+        uint32_t storageSize = 0;
+
+        retVal = Sys_StorageGetSize(&storageSize);
+        if (retVal != SysStatus_Success || storageSize < getStorageEnd())
+        {
+            LOG_ERROR("Insufficient Storage! %d", retVal);
+            Sys_Exit();
+        }
+    }
+
+    retVal = initialiseDeviceKeys();
+    if (retVal != SysStatus_Success)
+    {
+        LOG_ERROR("Device Key Init Fails! %d", retVal);
+        Sys_Exit();
+    }
+#endif
+
+#if CFG_US_TINYAES_MAX_NUM_OF_STORED_KEY > 0
+    retVal = initialiseKeyStore();
+    if (retVal != SysStatus_Success)
+    {
+        LOG_ERROR("Key Store Init Fails! %d", retVal);
+        Sys_Exit();
+    }
+#endif
+
+#if CFG_US_TINYAES_SESSION_IDLE_TIMEOUT_MS > 0
+    SYS_INITIALISE_USER_TIMERS(retVal, 1);
+    if (retVal != SysStatus_Success)
+    {
+        LOG_ERROR("Timer Init Fails! %d", retVal);
+        Sys_Exit();
+    }
+
+    /* The first sweep sets the timer */
+    sessionTable.idleTimerFlag = true;
+#endif
+
+#if CFG_US_TINYAES_NUM_OF_WORKERS > 0
+    retVal = startWorkers();
+    if (retVal != SysStatus_Success)
+    {
+        LOG_ERROR("Worker Init Fails! %d", retVal);
+        Sys_Exit();
+    }
 #endif
 
     startAESService();